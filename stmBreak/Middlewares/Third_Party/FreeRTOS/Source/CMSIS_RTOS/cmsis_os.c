@@ -97,6 +97,7 @@
   */ 
 
 #include <string.h>
+#include "cmsis_device.h"  /* __LDREXW and __STREXW of the core */
 #include "cmsis_os.h"
 
 extern void xPortSysTickHandler(void);
@@ -205,10 +206,10 @@ osThreadId osThreadCreate (const osThreadDef_t *thread_def, void *argument)
 {
   TaskHandle_t handle;
   
-  
-  if (xTaskCreate((TaskFunction_t)thread_def->pthread,(const portCHAR *)thread_def->name,
+  /* A NULL stack, see osThreadDef, is taken from the heap */
+  if (xTaskGenericCreate((TaskFunction_t)thread_def->pthread,(const portCHAR *)thread_def->name,
               thread_def->stacksize, argument, makeFreeRtosPriority(thread_def->tpriority),
-              &handle) != pdPASS)  {
+              &handle, thread_def->stack, NULL) != pdPASS)  {
     return NULL;
   }
   
@@ -761,19 +762,35 @@ osStatus osSemaphoreDelete (osSemaphoreId semaphore_id)
 
 #if (defined (osFeature_Pool)  &&  (osFeature_Pool != 0)) 
 
-//TODO
-//This is a primitive and inefficient wrapper around the existing FreeRTOS memory management.
-//A better implementation will have to modify heap_x.c!
-
+/* Free blocks form a list through their first word, free_list holds the
+ * address of the first one. Alloc pops and free pushes it with LDREX/STREX,
+ * so neither masks interrupts and both are O(1) from any priority. An
+ * interrupt between LDREX and STREX clears the exclusive monitor, the STREX
+ * then fails and the loop reads the list again, so a block popped and
+ * pushed back by the interrupt (ABA) cannot corrupt the list. */
 
-typedef struct os_pool_cb {
-  void *pool;
-  uint8_t *markers;
-  uint32_t pool_sz;
-  uint32_t item_sz;
-  uint32_t currentIndex;
-} os_pool_cb_t;
+/* Atomic add on a pool counter, returns the new value */
+static uint32_t poolCounterAdd (volatile uint32_t *counter, int32_t delta)
+{
+  uint32_t value;
+  
+  do {
+    value = __LDREXW(counter) + delta;
+  } while (__STREXW(value, counter) != 0);
+  
+  return value;
+}
 
+/* Atomic counter = max(counter, value) */
+static void poolCounterMax (volatile uint32_t *counter, uint32_t value)
+{
+  do {
+    if (__LDREXW(counter) >= value) {
+      __CLREX();
+      return;
+    }
+  } while (__STREXW(value, counter) != 0);
+}
 
 /**
 * @brief Create and Initialize a memory pool
@@ -784,39 +801,50 @@ typedef struct os_pool_cb {
 osPoolId osPoolCreate (const osPoolDef_t *pool_def)
 {
   osPoolId thePool;
-  int itemSize = 4 * ((pool_def->item_sz + 3) / 4);
+  /* Whole words, a free block holds the address of the next one */
+  uint32_t itemSize = 4 * ((pool_def->item_sz + 3) / 4);
+  uint32_t block;
   uint32_t i;
   
-  /* First have to allocate memory for the pool control block. */
-  thePool = pvPortMalloc(sizeof(os_pool_cb_t));
-  if (thePool) {
-    thePool->pool_sz = pool_def->pool_sz;
-    thePool->item_sz = itemSize;
-    thePool->currentIndex = 0;
-    
-    /* Memory for markers */
-    thePool->markers = pvPortMalloc(pool_def->pool_sz);
-    if (thePool->markers) {
-      /* Now allocate the pool itself. */
-      thePool->pool = pvPortMalloc(pool_def->pool_sz * itemSize);
-      
-      if (thePool->pool) {
-        for (i = 0; i < pool_def->pool_sz; i++) {
-          thePool->markers[i] = 0;
-        }
-      }
-      else {
-        vPortFree(thePool->markers);
-        vPortFree(thePool);
-        thePool = NULL;
-      }
+  if ((pool_def->pool_sz == 0) || (itemSize == 0)) {
+    return NULL;
+  }
+  
+  /* osPoolStaticDef reserved all of it already */
+  if (pool_def->cb != NULL) {
+    thePool = pool_def->cb;
+    thePool->pool = pool_def->pool;
+  }
+  else {
+    /* First have to allocate memory for the pool control block. */
+    thePool = pvPortMalloc(sizeof(os_pool_cb_t));
+    if (thePool == NULL) {
+      return NULL;
     }
-    else {
+    
+    /* Now allocate the pool itself. */
+    thePool->pool = pvPortMalloc(pool_def->pool_sz * itemSize);
+    if (thePool->pool == NULL) {
       vPortFree(thePool);
-      thePool = NULL;
+      return NULL;
     }
   }
   
+  thePool->pool_sz = pool_def->pool_sz;
+  thePool->item_sz = itemSize;
+  thePool->used = 0;
+  thePool->high_water = 0;
+  thePool->failures = 0;
+  
+  /* Link all blocks in address order, the last one ends the list */
+  block = (uint32_t)thePool->pool;
+  for (i = 0; i < pool_def->pool_sz - 1; i++) {
+    *(uint32_t *)block = block + itemSize;
+    block += itemSize;
+  }
+  *(uint32_t *)block = 0;
+  thePool->free_list = (uint32_t)thePool->pool;
+  
   return thePool;
 }
 
@@ -828,40 +856,24 @@ osPoolId osPoolCreate (const osPoolDef_t *pool_def)
 */
 void *osPoolAlloc (osPoolId pool_id)
 {
-  int dummy = 0;
-  void *p = NULL;
-  uint32_t i;
-  uint32_t index;
+  uint32_t block;
   
-  if (inHandlerMode()) {
-    dummy = portSET_INTERRUPT_MASK_FROM_ISR();
-  }
-  else {
-    vPortEnterCritical();
+  if (pool_id == NULL) {
+    return NULL;
   }
   
-  for (i = 0; i < pool_id->pool_sz; i++) {
-    index = pool_id->currentIndex + i;
-    if (index >= pool_id->pool_sz) {
-      index = 0;
-    }
-    
-    if (pool_id->markers[index] == 0) {
-      pool_id->markers[index] = 1;
-      p = (void *)((uint32_t)(pool_id->pool) + (index * pool_id->item_sz));
-      pool_id->currentIndex = index;
-      break;
+  do {
+    block = __LDREXW(&pool_id->free_list);
+    if (block == 0) {
+      __CLREX();
+      poolCounterAdd(&pool_id->failures, 1);
+      return NULL;
     }
-  }
+  } while (__STREXW(*(uint32_t *)block, &pool_id->free_list) != 0);
   
-  if (inHandlerMode()) {
-    portCLEAR_INTERRUPT_MASK_FROM_ISR(dummy);
-  }
-  else {
-    vPortExitCritical();
-  }
+  poolCounterMax(&pool_id->high_water, poolCounterAdd(&pool_id->used, 1));
   
-  return p;
+  return (void *)block;
 }
 
 /**
@@ -876,7 +888,7 @@ void *osPoolCAlloc (osPoolId pool_id)
   
   if (p != NULL)
   {
-    memset(p, 0, sizeof(pool_id->pool_sz));
+    memset(p, 0, pool_id->item_sz);
   }
   
   return p;
@@ -888,6 +900,7 @@ void *osPoolCAlloc (osPoolId pool_id)
 * @param  block         address of the allocated memory block that is returned to the memory pool.
 * @retval  status code that indicates the execution status of the function.
 * @note   MUST REMAIN UNCHANGED: \b osPoolFree shall be consistent in every CMSIS-RTOS.
+* @note   Freeing a block twice is not detected and corrupts the pool.
 */
 osStatus osPoolFree (osPoolId pool_id, void *block)
 {
@@ -914,7 +927,39 @@ osStatus osPoolFree (osPoolId pool_id, void *block)
     return osErrorParameter;
   }
   
-  pool_id->markers[index] = 0;
+#if configASSERT_DEFINED
+  /* Cheap double free check: a block must be out, and not the one freed
+     last, which heads the free list */
+  configASSERT(pool_id->used != 0);
+  configASSERT((uint32_t)block != pool_id->free_list);
+#endif
+  
+  do {
+    *(uint32_t *)block = __LDREXW(&pool_id->free_list);
+  } while (__STREXW((uint32_t)block, &pool_id->free_list) != 0);
+  
+  poolCounterAdd(&pool_id->used, -1);
+  
+  return osOK;
+}
+
+/**
+* @brief Read the usage counters of a memory pool
+* @param  pool_id       memory pool ID obtain referenced with \ref osPoolCreate.
+* @param  info          set to the pool size, blocks in use, their high water mark and failed allocations.
+* @retval  status code that indicates the execution status of the function.
+* @note   Not part of CMSIS-RTOS.
+*/
+osStatus osPoolGetInfo (osPoolId pool_id, osPoolInfo_t *info)
+{
+  if ((pool_id == NULL) || (info == NULL)) {
+    return osErrorParameter;
+  }
+  
+  info->pool_sz = pool_id->pool_sz;
+  info->used = pool_id->used;
+  info->high_water = pool_id->high_water;
+  info->failures = pool_id->failures;
   
   return osOK;
 }
@@ -1053,7 +1098,7 @@ osMailQId osMailCreate (const osMailQDef_t *queue_def, osThreadId thread_id)
 {
   (void) thread_id;
   
-  osPoolDef_t pool_def = {queue_def->queue_sz, queue_def->item_sz, NULL};
+  osPoolDef_t pool_def = {queue_def->queue_sz, queue_def->item_sz, NULL, NULL};
   
   
   /* Create a mail queue control block */
@@ -333,6 +333,7 @@ typedef struct os_thread_def  {
   osPriority             tpriority;    ///< initial thread priority
   uint32_t               instances;    ///< maximum number of instances of that thread function
   uint32_t               stacksize;    ///< stack size requirements in bytes; 0 is default stack size
+  StackType_t               *stack;    ///< stack of osThreadStaticDef, NULL takes it from the heap
 } osThreadDef_t;
 
 /// Timer Definition structure contains timer parameters.
@@ -359,8 +360,35 @@ typedef struct os_pool_def  {
   uint32_t                 pool_sz;    ///< number of items (elements) in the pool
   uint32_t                 item_sz;    ///< size of an item
   void                       *pool;    ///< pointer to memory for pool
+  struct os_pool_cb            *cb;    ///< control block, with pool set by osPoolStaticDef
 } osPoolDef_t;
 
+/// Memory pool control block, public for osPoolStaticDef.
+/// \note CAN BE CHANGED: \b os_pool_cb is implementation specific in every CMSIS-RTOS.
+typedef struct os_pool_cb {
+  void *pool;
+  uint32_t pool_sz;
+  uint32_t item_sz;
+  volatile uint32_t free_list;   ///< address of the first free block, 0 if none
+  volatile uint32_t used;        ///< blocks allocated
+  volatile uint32_t high_water;  ///< most blocks allocated at once
+  volatile uint32_t failures;    ///< osPoolAlloc calls on an empty pool
+} os_pool_cb_t;
+
+/// Memory pool usage, see \ref osPoolGetInfo.
+typedef struct os_pool_info {
+  uint32_t                 pool_sz;    ///< number of items (elements) in the pool
+  uint32_t                    used;    ///< items allocated
+  uint32_t              high_water;    ///< most items allocated at once
+  uint32_t                failures;    ///< osPoolAlloc calls on an empty pool
+} osPoolInfo_t;
+
+/// Section of the stacks and pools of osThreadStaticDef and osPoolStaticDef,
+/// named so that the map file lists them apart. Defaults to .bss.
+#ifndef osStaticSection
+#define osStaticSection ".bss.os"
+#endif
+
 /// Definition structure for message queue.
 /// \note CAN BE CHANGED: \b os_messageQ_def is implementation specific in every CMSIS-RTOS.
 typedef struct os_messageQ_def  {
@@ -444,7 +472,25 @@ extern const osThreadDef_t os_thread_def_##name
 #else                            // define the object
 #define osThreadDef(name, thread, priority, instances, stacksz)  \
 const osThreadDef_t os_thread_def_##name = \
-{ #name, (thread), (priority), (instances), (stacksz)  }
+{ #name, (thread), (priority), (instances), (stacksz), NULL }
+#endif
+
+/// Create a Thread Definition with its stack reserved at compile time, in
+/// \ref osStaticSection. \b osThreadCreate then takes only the thread control
+/// block from the heap. Create the thread once, the stack is not shared.
+/// \param         name         name of the thread function.
+/// \param         priority     initial priority of the thread function.
+/// \param         instances    number of possible thread instances.
+/// \param         stacksz      stack size in words (StackType_t).
+#if defined (osObjectsExternal)  // object is external
+#define osThreadStaticDef(name, thread, priority, instances, stacksz)  \
+extern const osThreadDef_t os_thread_def_##name
+#else                            // define the object
+#define osThreadStaticDef(name, thread, priority, instances, stacksz)  \
+static StackType_t os_thread_stack_##name[(stacksz)] \
+  __attribute__((section(osStaticSection))); \
+const osThreadDef_t os_thread_def_##name = \
+{ #name, (thread), (priority), (instances), (stacksz), os_thread_stack_##name }
 #endif
 
 /// Access a Thread definition.
@@ -698,7 +744,25 @@ extern const osPoolDef_t os_pool_def_##name
 #else                            // define the object
 #define osPoolDef(name, no, type)   \
 const osPoolDef_t os_pool_def_##name = \
-{ (no), sizeof(type), NULL }
+{ (no), sizeof(type), NULL, NULL }
+#endif
+
+/// \brief Define a Memory Pool reserved at compile time, in \ref osStaticSection.
+/// \b osPoolCreate then takes nothing from the heap. Create the pool once.
+/// \param         name          name of the memory pool.
+/// \param         no            maximum number of blocks (objects) in the memory pool.
+/// \param         type          data type of a single block (object).
+#if defined (osObjectsExternal)  // object is external
+#define osPoolStaticDef(name, no, type)   \
+extern const osPoolDef_t os_pool_def_##name
+#else                            // define the object
+#define osPoolStaticDef(name, no, type)   \
+static uint32_t os_pool_m_##name[(no) * ((sizeof(type) + 3) / 4)] \
+  __attribute__((section(osStaticSection))); \
+static os_pool_cb_t os_pool_cb_##name \
+  __attribute__((section(osStaticSection))); \
+const osPoolDef_t os_pool_def_##name = \
+{ (no), sizeof(type), os_pool_m_##name, &os_pool_cb_##name }
 #endif
 
 /// \brief Access a Memory Pool definition.
@@ -733,6 +797,12 @@ void *osPoolCAlloc (osPoolId pool_id);
 /// \note MUST REMAIN UNCHANGED: \b osPoolFree shall be consistent in every CMSIS-RTOS.
 osStatus osPoolFree (osPoolId pool_id, void *block);
 
+/// Read the usage counters of a memory pool, not part of CMSIS-RTOS.
+/// \param[in]     pool_id       memory pool ID obtain referenced with \ref osPoolCreate.
+/// \param[out]    info          set to the pool size, blocks in use, their high water mark and failed allocations.
+/// \return osOK, or osErrorParameter if pool_id or info is NULL.
+osStatus osPoolGetInfo (osPoolId pool_id, osPoolInfo_t *info);
+
 #endif   // Memory Pool Management available
 
 
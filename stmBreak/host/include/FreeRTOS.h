@@ -0,0 +1,10 @@
+#ifndef INC_FREERTOS_H
+#define INC_FREERTOS_H
+
+/* Host build, the FreeRTOS types the firmware uses next to CMSIS-RTOS */
+
+#include <stdint.h>
+
+typedef long BaseType_t;
+
+#endif /* INC_FREERTOS_H */
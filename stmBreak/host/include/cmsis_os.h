@@ -0,0 +1,119 @@
+#ifndef __CMSIS_OS_H
+#define __CMSIS_OS_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/*
+ * The CMSIS-RTOS calls the firmware makes, on POSIX threads for the host
+ * build, see host/src/cmsis_os.c.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define osWaitForever 0xFFFFFFFF
+
+typedef enum
+{
+  osOK = 0,
+  osEventSignal = 0x08,
+  osEventMessage = 0x10,
+  osEventMail = 0x20,
+  osEventTimeout = 0x40,
+  osErrorParameter = 0x80,
+  osErrorResource = 0x81,
+  osErrorNoMemory = 0x85,
+  osErrorOS = 0xFF
+} osStatus;
+
+typedef enum
+{
+  osPriorityIdle = -3,
+  osPriorityLow = -2,
+  osPriorityBelowNormal = -1,
+  osPriorityNormal = 0,
+  osPriorityAboveNormal = +1,
+  osPriorityHigh = +2,
+  osPriorityRealtime = +3,
+  osPriorityError = 0x84
+} osPriority;
+
+typedef void (*os_pthread)(void const* argument);
+
+typedef struct os_thread_def
+{
+  const char* name;
+  os_pthread pthread;
+  osPriority tpriority;
+  uint32_t instances;
+  uint32_t stacksize;
+} osThreadDef_t;
+
+typedef struct os_mutex_def { uint32_t dummy; } osMutexDef_t;
+typedef struct os_semaphore_def { uint32_t dummy; } osSemaphoreDef_t;
+
+typedef struct os_mailQ_def
+{
+  uint32_t queue_sz;
+  uint32_t item_sz;
+} osMailQDef_t;
+
+typedef struct os_thread_cb* osThreadId;
+typedef struct os_mutex_cb* osMutexId;
+typedef struct os_semaphore_cb* osSemaphoreId;
+typedef struct os_mailQ_cb* osMailQId;
+
+typedef struct
+{
+  osStatus status;
+  union
+  {
+    uint32_t v;
+    void* p;
+    int32_t signals;
+  } value;
+} osEvent;
+
+#define osThreadDef(name, thread, priority, instances, stacksz) \
+const osThreadDef_t os_thread_def_##name = \
+{ #name, (thread), (priority), (instances), (stacksz) }
+#define osThreadStaticDef(name, thread, priority, instances, stacksz) \
+osThreadDef(name, thread, priority, instances, stacksz)
+#define osThread(name) &os_thread_def_##name
+
+#define osMutexDef(name) const osMutexDef_t os_mutex_def_##name = { 0 }
+#define osMutex(name) &os_mutex_def_##name
+
+#define osSemaphoreDef(name) \
+const osSemaphoreDef_t os_semaphore_def_##name = { 0 }
+#define osSemaphore(name) &os_semaphore_def_##name
+
+#define osMailQDef(name, queue_sz, type) \
+const osMailQDef_t os_mailQ_def_##name = { (queue_sz), sizeof(type) }
+#define osMailQ(name) &os_mailQ_def_##name
+
+osThreadId osThreadCreate(const osThreadDef_t* thread_def, void* argument);
+osStatus osDelay(uint32_t millisec);
+
+osMutexId osMutexCreate(const osMutexDef_t* mutex_def);
+osStatus osMutexWait(osMutexId mutex_id, uint32_t millisec);
+osStatus osMutexRelease(osMutexId mutex_id);
+
+osSemaphoreId osSemaphoreCreate(const osSemaphoreDef_t* semaphore_def,
+                                int32_t count);
+int32_t osSemaphoreWait(osSemaphoreId semaphore_id, uint32_t millisec);
+osStatus osSemaphoreRelease(osSemaphoreId semaphore_id);
+
+osMailQId osMailCreate(const osMailQDef_t* queue_def, osThreadId thread_id);
+void* osMailAlloc(osMailQId queue_id, uint32_t millisec);
+osStatus osMailPut(osMailQId queue_id, void* mail);
+osEvent osMailGet(osMailQId queue_id, uint32_t millisec);
+osStatus osMailFree(osMailQId queue_id, void* mail);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __CMSIS_OS_H */
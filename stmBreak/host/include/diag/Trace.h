@@ -0,0 +1,12 @@
+#ifndef DIAG_TRACE_H_
+#define DIAG_TRACE_H_
+
+/* Host build, the trace channel is stdout */
+
+#include <stdio.h>
+
+#define trace_printf printf
+#define trace_puts puts
+#define trace_putchar putchar
+
+#endif /* DIAG_TRACE_H_ */
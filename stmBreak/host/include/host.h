@@ -0,0 +1,31 @@
+#ifndef __HOST_H
+#define __HOST_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Controls of the host device stubs, see host/src/device.c. The flash is
+ * an image at its real address, programming only clears bits like NOR
+ * flash does.
+ */
+
+#define HOST_FLASH_BASE 0x08000000
+#define HOST_FLASH_SIZE 0x100000
+
+void setupHostFlash(const uint8_t fill);
+void setHostFlashBudget(const int32_t bytes);
+uint32_t getHostFlashErases(const uint32_t sector);
+void setHostUart(const int fd);
+void setHostAdc(const uint32_t adcRaw);
+uint32_t getHostPwm(void);
+uint64_t getHostTime(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __HOST_H */
@@ -0,0 +1,14 @@
+#ifndef INC_TASK_H
+#define INC_TASK_H
+
+/* Host build, the task calls the firmware makes, see host/src/cmsis_os.c */
+
+#include "FreeRTOS.h"
+
+#define taskSCHEDULER_SUSPENDED   ((BaseType_t)0)
+#define taskSCHEDULER_NOT_STARTED ((BaseType_t)1)
+#define taskSCHEDULER_RUNNING     ((BaseType_t)2)
+
+BaseType_t xTaskGetSchedulerState(void);
+
+#endif /* INC_TASK_H */
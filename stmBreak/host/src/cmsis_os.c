@@ -0,0 +1,306 @@
+#include "cmsis_os.h"
+#include "task.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * CMSIS-RTOS on POSIX threads. Threads are detached pthreads, mutexes are
+ * not recursive like the FreeRTOS ones, a semaphore created with count 1
+ * is binary and starts available, a mail queue is a FIFO of heap blocks.
+ */
+
+struct os_mutex_cb
+{
+  pthread_mutex_t mutex;
+};
+
+struct os_semaphore_cb
+{
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  int32_t count;
+  int32_t max;
+};
+
+struct os_mailQ_cb
+{
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  uint32_t size;
+  uint32_t itemSize;
+  uint32_t head;
+  uint32_t count;  // blocks put and not yet got
+  uint32_t used;   // blocks allocated and not yet freed
+  void* items[];
+};
+
+typedef struct ThreadStart
+{
+  os_pthread pthread;
+  void* argument;
+} ThreadStart;
+
+/**
+ * @param millisec timeout from now
+ * @return absolute CLOCK_REALTIME deadline, as pthread timed waits take it
+ */
+static struct timespec getDeadline(const uint32_t millisec)
+{
+  struct timespec deadline;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += millisec / 1000;
+  deadline.tv_nsec += (long)(millisec % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000)
+  {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  return deadline;
+}
+
+/**
+ * Wait for a change signalled on changed, lock held.
+ * @return 0 once the deadline passed
+ */
+static uint8_t waitChanged(pthread_cond_t* changed, pthread_mutex_t* lock,
+                           const uint32_t millisec,
+                           const struct timespec* deadline)
+{
+  if (millisec == 0)
+  {
+    return 0;
+  }
+  if (millisec == osWaitForever)
+  {
+    pthread_cond_wait(changed, lock);
+    return 1;
+  }
+  return pthread_cond_timedwait(changed, lock, deadline) != ETIMEDOUT;
+}
+
+static void* runThread(void* start)
+{
+  const ThreadStart thread = *(ThreadStart*)start;
+
+  free(start);
+  thread.pthread(thread.argument);
+  return NULL;
+}
+
+osThreadId osThreadCreate(const osThreadDef_t* thread_def, void* argument)
+{
+  ThreadStart* start = malloc(sizeof(ThreadStart));
+  pthread_t thread;
+
+  if (start == NULL)
+  {
+    return NULL;
+  }
+  start->pthread = thread_def->pthread;
+  start->argument = argument;
+  if (pthread_create(&thread, NULL, runThread, start) != 0)
+  {
+    free(start);
+    return NULL;
+  }
+  pthread_detach(thread);
+  return (osThreadId)start;
+}
+
+osStatus osDelay(uint32_t millisec)
+{
+  struct timespec delay;
+
+  delay.tv_sec = millisec / 1000;
+  delay.tv_nsec = (long)(millisec % 1000) * 1000000;
+  nanosleep(&delay, NULL);
+  return osOK;
+}
+
+/**
+ * Threads run as soon as they are created, there is no scheduler start.
+ */
+BaseType_t xTaskGetSchedulerState(void)
+{
+  return taskSCHEDULER_RUNNING;
+}
+
+osMutexId osMutexCreate(const osMutexDef_t* mutex_def)
+{
+  osMutexId mutex = malloc(sizeof(struct os_mutex_cb));
+
+  if (mutex)
+  {
+    pthread_mutex_init(&mutex->mutex, NULL);
+  }
+  return mutex;
+}
+
+osStatus osMutexWait(osMutexId mutex_id, uint32_t millisec)
+{
+  int result;
+
+  if (millisec == osWaitForever)
+  {
+    result = pthread_mutex_lock(&mutex_id->mutex);
+  }
+  else if (millisec == 0)
+  {
+    result = pthread_mutex_trylock(&mutex_id->mutex);
+  }
+  else
+  {
+    const struct timespec deadline = getDeadline(millisec);
+    result = pthread_mutex_timedlock(&mutex_id->mutex, &deadline);
+  }
+  return (result == 0) ? osOK : osErrorOS;
+}
+
+osStatus osMutexRelease(osMutexId mutex_id)
+{
+  return (pthread_mutex_unlock(&mutex_id->mutex) == 0) ? osOK : osErrorOS;
+}
+
+osSemaphoreId osSemaphoreCreate(const osSemaphoreDef_t* semaphore_def,
+                                int32_t count)
+{
+  osSemaphoreId semaphore = malloc(sizeof(struct os_semaphore_cb));
+
+  if (semaphore)
+  {
+    pthread_mutex_init(&semaphore->lock, NULL);
+    pthread_cond_init(&semaphore->changed, NULL);
+    semaphore->count = (count == 1) ? 1 : 0;
+    semaphore->max = count;
+  }
+  return semaphore;
+}
+
+int32_t osSemaphoreWait(osSemaphoreId semaphore_id, uint32_t millisec)
+{
+  const struct timespec deadline = getDeadline(millisec);
+  osStatus status = osOK;
+
+  pthread_mutex_lock(&semaphore_id->lock);
+  while (semaphore_id->count == 0)
+  {
+    if (!waitChanged(&semaphore_id->changed, &semaphore_id->lock, millisec,
+                     &deadline))
+    {
+      status = osErrorOS;
+      break;
+    }
+  }
+  if (status == osOK)
+  {
+    semaphore_id->count--;
+  }
+  pthread_mutex_unlock(&semaphore_id->lock);
+  return status;
+}
+
+osStatus osSemaphoreRelease(osSemaphoreId semaphore_id)
+{
+  osStatus status = osErrorOS;
+
+  pthread_mutex_lock(&semaphore_id->lock);
+  if (semaphore_id->count < semaphore_id->max)
+  {
+    semaphore_id->count++;
+    pthread_cond_signal(&semaphore_id->changed);
+    status = osOK;
+  }
+  pthread_mutex_unlock(&semaphore_id->lock);
+  return status;
+}
+
+osMailQId osMailCreate(const osMailQDef_t* queue_def, osThreadId thread_id)
+{
+  osMailQId queue = malloc(sizeof(struct os_mailQ_cb)
+                           + (queue_def->queue_sz * sizeof(void*)));
+
+  if (queue)
+  {
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->size = queue_def->queue_sz;
+    queue->itemSize = queue_def->item_sz;
+    queue->head = 0;
+    queue->count = 0;
+    queue->used = 0;
+  }
+  return queue;
+}
+
+/**
+ * Never waits, queue_sz blocks at most are allocated like from the pool
+ * behind a FreeRTOS mail queue.
+ */
+void* osMailAlloc(osMailQId queue_id, uint32_t millisec)
+{
+  void* mail = NULL;
+
+  pthread_mutex_lock(&queue_id->lock);
+  if (queue_id->used < queue_id->size)
+  {
+    mail = malloc(queue_id->itemSize);
+    queue_id->used += (mail != NULL);
+  }
+  pthread_mutex_unlock(&queue_id->lock);
+  return mail;
+}
+
+osStatus osMailPut(osMailQId queue_id, void* mail)
+{
+  osStatus status = osErrorResource;
+
+  pthread_mutex_lock(&queue_id->lock);
+  if (queue_id->count < queue_id->size)
+  {
+    queue_id->items[(queue_id->head + queue_id->count) % queue_id->size] = mail;
+    queue_id->count++;
+    pthread_cond_broadcast(&queue_id->changed);
+    status = osOK;
+  }
+  pthread_mutex_unlock(&queue_id->lock);
+  return status;
+}
+
+osEvent osMailGet(osMailQId queue_id, uint32_t millisec)
+{
+  const struct timespec deadline = getDeadline(millisec);
+  osEvent event;
+
+  event.status = osEventTimeout;
+  event.value.p = NULL;
+
+  pthread_mutex_lock(&queue_id->lock);
+  while (queue_id->count == 0)
+  {
+    if (!waitChanged(&queue_id->changed, &queue_id->lock, millisec, &deadline))
+    {
+      break;
+    }
+  }
+  if (queue_id->count > 0)
+  {
+    event.status = osEventMail;
+    event.value.p = queue_id->items[queue_id->head];
+    queue_id->head = (queue_id->head + 1) % queue_id->size;
+    queue_id->count--;
+  }
+  pthread_mutex_unlock(&queue_id->lock);
+  return event;
+}
+
+osStatus osMailFree(osMailQId queue_id, void* mail)
+{
+  pthread_mutex_lock(&queue_id->lock);
+  queue_id->used--;
+  pthread_mutex_unlock(&queue_id->lock);
+  free(mail);
+  return osOK;
+}
@@ -0,0 +1,365 @@
+#include "device.h"
+#include "host.h"
+#include "protocol.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * device.h on the host. The flash is a mapped image at 0x08000000 with the
+ * sector layout of the STM32F405, so the store finds its records where the
+ * firmware does. The CRC unit is crc32(), PWM and ADC are plain variables.
+ * USART1 is a file descriptor, e.g. a pty, see setHostUart().
+ */
+
+#define FLASH_SECTOR_COUNT 12
+
+static const uint32_t FLASH_SECTORS[FLASH_SECTOR_COUNT] =
+{
+  0x08000000, 0x08004000, 0x08008000, 0x0800C000, 0x08010000, 0x08020000,
+  0x08040000, 0x08060000, 0x08080000, 0x080A0000, 0x080C0000, 0x080E0000
+};
+
+static uint8_t* flashImage = NULL;
+static int32_t flashBudget = -1;
+static uint32_t flashErases[FLASH_SECTOR_COUNT];
+
+static uint32_t hostAdc = 0;
+static uint32_t hostPwm = 0;
+
+/* Stands in for the USART1 RX DMA ring, filled by uartThread() */
+static int uartFd = -1;
+static pthread_mutex_t uartLock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t uartRxBuffer[CONFIG_UART_RX_BUFFER_SIZE];
+static uint32_t uartRxHead = 0;
+static uint32_t uartRxTail = 0;
+
+static AdcBlockHandler adcBlockHandler = NULL;
+static UartTxHandler uartTxHandler = NULL;
+static UartRxHandler uartRxHandler = NULL;
+static FlashWaitHandler flashWaitHandler = NULL;
+static FlashDoneHandler flashDoneHandler = NULL;
+
+static void* uartThread(void* argument);
+
+void setupDevice(void)
+{
+  setupHostFlash(0xFF);
+}
+
+/**
+ * Map the flash image, or refill it.
+ * @param fill byte the whole flash is set to, 0xFF for erased
+ */
+void setupHostFlash(const uint8_t fill)
+{
+  if (flashImage == NULL)
+  {
+    flashImage = mmap((void*)(uintptr_t)HOST_FLASH_BASE, HOST_FLASH_SIZE,
+                      PROT_READ | PROT_WRITE,
+                      MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (flashImage != (uint8_t*)(uintptr_t)HOST_FLASH_BASE)
+    {
+      fprintf(stderr, "Cannot map the flash at 0x%08X\n", HOST_FLASH_BASE);
+      exit(1);
+    }
+  }
+  memset(flashImage, fill, HOST_FLASH_SIZE);
+  memset(flashErases, 0, sizeof(flashErases));
+  flashBudget = -1;
+}
+
+/**
+ * Cut the power after a number of programmed bytes: later programs fail
+ * and erases do not start.
+ * @param bytes programmed bytes left, -1 for no limit
+ */
+void setHostFlashBudget(const int32_t bytes)
+{
+  flashBudget = bytes;
+}
+
+/**
+ * @param sector 0..11
+ * @return erases since setupHostFlash()
+ */
+uint32_t getHostFlashErases(const uint32_t sector)
+{
+  return flashErases[sector];
+}
+
+/**
+ * Connect USART1, received bytes land in the ring and every read burst
+ * calls the idle line handler, like the DMA and the IDLE interrupt do.
+ * @param fd open for reading and writing, raw mode for a tty
+ */
+void setHostUart(const int fd)
+{
+  pthread_t thread;
+
+  uartFd = fd;
+  pthread_create(&thread, NULL, uartThread, NULL);
+  pthread_detach(thread);
+}
+
+static void* uartThread(void* argument)
+{
+  uint8_t bytes[64];
+  ssize_t count;
+
+  while ((count = read(uartFd, bytes, sizeof(bytes))) > 0)
+  {
+    pthread_mutex_lock(&uartLock);
+    for (ssize_t i = 0; count > i; ++i)
+    {
+      uartRxBuffer[uartRxHead] = bytes[i];
+      uartRxHead = (uartRxHead + 1) % CONFIG_UART_RX_BUFFER_SIZE;
+    }
+    pthread_mutex_unlock(&uartLock);
+    uartRxIdle();
+  }
+  return NULL;
+}
+
+void setHostAdc(const uint32_t adcRaw)
+{
+  hostAdc = adcRaw;
+}
+
+uint32_t getHostPwm(void)
+{
+  return hostPwm;
+}
+
+/**
+ * @return monotonic time in ns
+ */
+uint64_t getHostTime(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000000000u) + (uint64_t)now.tv_nsec;
+}
+
+void setPwm(uint32_t dutyCycle)
+{
+  hostPwm = dutyCycle;
+}
+
+void startControlLoop(void)
+{}
+
+uint32_t getAdc(void)
+{
+  return hostAdc;
+}
+
+uint32_t setAdcSampleRate(uint32_t rateHz)
+{
+  return rateHz;
+}
+
+void setAdcBlockHandler(AdcBlockHandler handler)
+{
+  adcBlockHandler = handler;
+}
+
+/**
+ * Written out before returning, the transmit complete handler runs right
+ * away.
+ */
+uint8_t uartSend(const void* data, uint16_t size)
+{
+  const uint8_t* bytes = (const uint8_t*)data;
+
+  while ((uartFd >= 0) && (size > 0))
+  {
+    const ssize_t written = write(uartFd, bytes, size);
+    if (written <= 0)
+    {
+      return 0;
+    }
+    bytes += written;
+    size -= written;
+  }
+  if (uartTxHandler)
+  {
+    uartTxHandler();
+  }
+  return 1;
+}
+
+void setUartTxHandler(UartTxHandler handler)
+{
+  uartTxHandler = handler;
+}
+
+uint32_t uartReceive(void* data, uint32_t size)
+{
+  uint8_t* bytes = (uint8_t*)data;
+  uint32_t count = 0;
+
+  pthread_mutex_lock(&uartLock);
+  while ((uartRxTail != uartRxHead) && (size > count))
+  {
+    bytes[count++] = uartRxBuffer[uartRxTail];
+    uartRxTail = (uartRxTail + 1) % CONFIG_UART_RX_BUFFER_SIZE;
+  }
+  pthread_mutex_unlock(&uartLock);
+  return count;
+}
+
+void setUartRxHandler(UartRxHandler handler)
+{
+  uartRxHandler = handler;
+}
+
+void uartRxIdle(void)
+{
+  if (uartRxHandler)
+  {
+    uartRxHandler();
+  }
+}
+
+uint32_t getFlashSector(uint32_t address)
+{
+  uint32_t sector = FLASH_SECTOR_COUNT - 1;
+
+  while ((sector > 0) && (address < FLASH_SECTORS[sector]))
+  {
+    sector--;
+  }
+  return sector;
+}
+
+uint32_t getFlashSectorAddress(uint32_t sector)
+{
+  return FLASH_SECTORS[sector];
+}
+
+uint32_t getFlashSectorSize(uint32_t sector)
+{
+  if (sector <= 3)
+  {
+    return 16 * 1024;
+  }
+  else if (sector == 4)
+  {
+    return 64 * 1024;
+  }
+  return 128 * 1024;
+}
+
+uint8_t eraseFlash(uint32_t firstSector, uint32_t count)
+{
+  for (uint32_t sector = firstSector; (firstSector + count) > sector; ++sector)
+  {
+    if (flashBudget == 0)
+    {
+      return 0;
+    }
+    memset((void*)(uintptr_t)FLASH_SECTORS[sector], 0xFF,
+           getFlashSectorSize(sector));
+    flashErases[sector]++;
+  }
+  return 1;
+}
+
+/**
+ * Program like NOR flash, bits only go from 1 to 0. Programming a bit back
+ * to 1 is a bug of the caller and stops the program.
+ */
+uint8_t programFlash(uint32_t address, const void* data, uint32_t size,
+                     uint32_t itemSize)
+{
+  const uint8_t* bytes = (const uint8_t*)data;
+
+  if ((itemSize != 1) && (itemSize != 2) && (itemSize != 4) && (itemSize != 8))
+  {
+    return 0;
+  }
+  if ((address < HOST_FLASH_BASE)
+      || ((address + (size * itemSize)) > (HOST_FLASH_BASE + HOST_FLASH_SIZE)))
+  {
+    return 0;
+  }
+
+  for (uint32_t i = 0; (size * itemSize) > i; ++i)
+  {
+    uint8_t* cell = (uint8_t*)(uintptr_t)(address + i);
+
+    if (flashBudget == 0)
+    {
+      return 0;
+    }
+    if (flashBudget > 0)
+    {
+      flashBudget--;
+    }
+    if ((*cell & bytes[i]) != bytes[i])
+    {
+      fprintf(stderr, "Programming 0 to 1 at 0x%08X\n", address + i);
+      exit(1);
+    }
+    *cell &= bytes[i];
+  }
+  return 1;
+}
+
+uint32_t getFlashError(void)
+{
+  return 0;
+}
+
+void setFlashWaitHandler(FlashWaitHandler handler)
+{
+  flashWaitHandler = handler;
+}
+
+void setFlashDoneHandler(FlashDoneHandler handler)
+{
+  flashDoneHandler = handler;
+}
+
+void flashEndOfOperation(void)
+{
+  if (flashDoneHandler)
+  {
+    flashDoneHandler();
+  }
+}
+
+uint32_t computeCrc(const void* data, const uint32_t size, const uint32_t crc)
+{
+  return crc32((const uint8_t*)data, size, crc);
+}
+
+#if CONFIG_USE_SCRIPTED_ADC
+void scriptedAdcSample(void)
+{}
+#endif
+
+/**
+ * @return ns since boot, wraps like the DWT counter
+ */
+uint32_t getCycleCount(void)
+{
+  return (uint32_t)getHostTime();
+}
+
+uint8_t isButtonOnBoardPressed(void)
+{
+  return 0;
+}
+
+void ledOnBoardOn(void)
+{}
+
+void ledOnBoardOff(void)
+{}
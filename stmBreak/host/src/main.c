@@ -0,0 +1,140 @@
+#include "curve.h"
+#include "device.h"
+#include "flash.h"
+#include "host.h"
+#include <stdio.h>
+
+/*
+ * Host counterpart of benchmarkCurves(): every brake function over all
+ * CURVE_SIZE ADC codes, through curveInput() and evaluateCurve() and
+ * through the built duty cycle table, then a flash bank round trip on the
+ * simulated flash.
+ */
+
+#define SWEEPS 200 // repetitions of each sweep, for a stable time
+
+static uint16_t userPoints[CURVE_USER_POINTS];
+static uint8_t userCode[CURVE_CODE_SIZE];
+static uint16_t userDecoded[CURVE_USER_POINTS];
+static uint16_t table[CURVE_SIZE];
+
+static uint32_t encodeUserPoints(void)
+{
+  for (uint32_t i = 0; CURVE_USER_POINTS > i; ++i)
+  {
+    userPoints[i] = (i * i) / CURVE_USER_POINTS;
+  }
+  return encodeCurve(userCode, CURVE_CODE_SIZE, userPoints, CURVE_USER_POINTS);
+}
+
+/**
+ * @param ns for SWEEPS sweeps of all CURVE_SIZE ADC codes
+ */
+static double nsPerSample(const uint64_t ns)
+{
+  return (double)ns / ((double)SWEEPS * CURVE_SIZE);
+}
+
+/* The float path of user curves indexes the points decoded once, as the
+ * firmware did before the table */
+static void benchmarkCurves(void)
+{
+  const uint32_t userSize = encodeUserPoints();
+  volatile uint32_t dutyCycle;
+  uint64_t start;
+  uint64_t floatNs;
+  uint64_t tableNs;
+  uint64_t buildNs;
+
+  decodeCurve(userDecoded, CURVE_USER_POINTS, userCode, userSize);
+  for (uint32_t function = 0; BF_NR_ITEMS > function; ++function)
+  {
+    Curve curve = { (BrakeFunction)function, 0, 1000, userCode, userSize,
+                    userDecoded };
+
+    start = getHostTime();
+    for (uint32_t sweep = 0; SWEEPS > sweep; ++sweep)
+    {
+      for (uint32_t adcRaw = 0; CURVE_SIZE > adcRaw; ++adcRaw)
+      {
+        dutyCycle = evaluateCurve(&curve, curveInput(adcRaw, curve.maxValue)) + 0.5f;
+      }
+    }
+    floatNs = getHostTime() - start;
+
+    start = getHostTime();
+    for (uint32_t sweep = 0; SWEEPS > sweep; ++sweep)
+    {
+      buildCurveTable(table, &curve);
+    }
+    buildNs = (getHostTime() - start) / SWEEPS;
+
+    start = getHostTime();
+    for (uint32_t sweep = 0; SWEEPS > sweep; ++sweep)
+    {
+      for (uint32_t adcRaw = 0; CURVE_SIZE > adcRaw; ++adcRaw)
+      {
+        dutyCycle = table[adcRaw];
+      }
+    }
+    tableNs = getHostTime() - start;
+
+    printf("curve %u: float %.2f ns/sample, table %.2f ns/sample, build %llu ns\n",
+           function, nsPerSample(floatNs), nsPerSample(tableNs),
+           (unsigned long long)buildNs);
+  }
+  (void)dutyCycle;
+}
+
+/**
+ * Store a user curve in a flash bank and read it back, like a commit from
+ * the serial protocol and the next boot.
+ * @return 0 on success
+ */
+static int benchmarkFlashBank(void)
+{
+  static uint8_t readBack[CURVE_CODE_SIZE];
+  const uint32_t userSize = encodeUserPoints();
+  const FlashBank bank = createFlashBank(CURVE_CODE_SIZE, FLASH_8B);
+  uint64_t start;
+  uint64_t writeNs;
+  uint64_t readNs;
+  uint32_t read;
+
+  start = getHostTime();
+  if (!writeToFlashBank(userCode, userSize, &bank))
+  {
+    printf("flash bank: write failed\n");
+    return 1;
+  }
+  writeNs = getHostTime() - start;
+
+  start = getHostTime();
+  read = readFromFlashBank(readBack, userSize, &bank);
+  readNs = getHostTime() - start;
+
+  for (uint32_t i = 0; userSize > i; ++i)
+  {
+    if (readBack[i] != userCode[i])
+    {
+      read = 0;
+    }
+  }
+  if (read != userSize)
+  {
+    printf("flash bank: read back %u of %u bytes\n", read, userSize);
+    return 1;
+  }
+  printf("flash bank: %u bytes, write %llu ns, read %llu ns\n", userSize,
+         (unsigned long long)writeNs, (unsigned long long)readNs);
+  return 0;
+}
+
+int main(void)
+{
+  setupDevice();
+  setupFlash();
+
+  benchmarkCurves();
+  return benchmarkFlashBank();
+}
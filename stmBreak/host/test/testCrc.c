@@ -0,0 +1,55 @@
+#include "protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The software crc32() has to give what the STM32 CRC unit gives, the store
+ * mixes both. The reference is the unit's result for the word 0x12345678
+ * from reset. Feeding in word aligned parts has to match one call, a last
+ * partial word is padded with zeros like computeCrc() does.
+ */
+
+int main(void)
+{
+  static uint8_t data[1024];
+  const uint32_t word = 0x12345678;
+  const uint32_t crc = crc32((const uint8_t*)&word, sizeof(word), CRC32_INIT);
+
+  if (crc != 0xDF8A8A2B)
+  {
+    printf("crc32 of 0x12345678 is %08X, the CRC unit gives DF8A8A2B\n", crc);
+    return 1;
+  }
+
+  srand(1);
+  for (uint32_t i = 0; sizeof(data) > i; ++i)
+  {
+    data[i] = rand();
+  }
+
+  const uint32_t whole = crc32(data, sizeof(data), CRC32_INIT);
+  for (uint32_t split = 0; sizeof(data) >= split; split += 4)
+  {
+    if (crc32(data + split, sizeof(data) - split,
+              crc32(data, split, CRC32_INIT)) != whole)
+    {
+      printf("split at %u differs\n", split);
+      return 1;
+    }
+  }
+
+  for (uint32_t size = 1; 4 > size; ++size)
+  {
+    uint8_t padded[4] = { 0 };
+    memcpy(padded, data, size);
+    if (crc32(data, size, CRC32_INIT) != crc32(padded, 4, CRC32_INIT))
+    {
+      printf("%u bytes are not padded with zeros\n", size);
+      return 1;
+    }
+  }
+
+  printf("ok\n");
+  return 0;
+}
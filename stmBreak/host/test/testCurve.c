@@ -0,0 +1,105 @@
+#include "curve.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Round trip of the user curve code. Random, smooth, alternating and flat
+ * curves have to decode to the points they were encoded from, a cut code
+ * must not decode to a full curve. The table built from the code has to
+ * match evaluateCurve() at every ADC code.
+ */
+
+#define ROUNDS 2000
+
+/**
+ * @return 0 if the points decode unchanged
+ */
+static int roundTrip(const uint16_t* points, const uint32_t round)
+{
+  static uint8_t code[CURVE_CODE_SIZE];
+  static uint16_t decoded[CURVE_USER_POINTS];
+
+  const uint32_t size = encodeCurve(code, sizeof(code), points, CURVE_USER_POINTS);
+  if ((size == 0)
+      || (decodeCurve(decoded, CURVE_USER_POINTS, code, size) != CURVE_USER_POINTS)
+      || memcmp(decoded, points, sizeof(decoded)))
+  {
+    printf("round %u does not decode\n", round);
+    return 1;
+  }
+  if (decodeCurve(decoded, CURVE_USER_POINTS, code, size - 1) == CURVE_USER_POINTS)
+  {
+    printf("round %u decodes without its last byte\n", round);
+    return 1;
+  }
+  if (round < 4)
+  {
+    printf("kind %u: %u bytes\n", round, size);
+  }
+  return 0;
+}
+
+int main(void)
+{
+  static uint16_t points[CURVE_USER_POINTS];
+  static uint8_t code[CURVE_CODE_SIZE];
+  static uint16_t table[CURVE_SIZE];
+
+  srand(1);
+  for (uint32_t round = 0; ROUNDS > round; ++round)
+  {
+    for (uint32_t i = 0; CURVE_USER_POINTS > i; ++i)
+    {
+      switch (round % 4)
+      {
+        case 0:
+          points[i] = rand();
+          break;
+        case 1:
+          points[i] = (i * i) / CURVE_USER_POINTS;
+          break;
+        case 2:
+          points[i] = (i & 1) ? 0xFFFF : 0;
+          break;
+        default:
+          points[i] = round;
+          break;
+      }
+    }
+    if (roundTrip(points, round))
+    {
+      return 1;
+    }
+  }
+
+  for (uint32_t i = 0; CURVE_USER_POINTS > i; ++i)
+  {
+    points[i] = (i * i) / CURVE_USER_POINTS;
+  }
+  Curve curve;
+  memset(&curve, 0, sizeof(curve));
+  curve.function = BF_USER1;
+  curve.maxValue = 999;
+  curve.userData = code;
+  curve.userSize = encodeCurve(code, sizeof(code), points, CURVE_USER_POINTS);
+  curve.userPoints = points;
+  buildCurveTable(table, &curve);
+
+  for (uint32_t adc = 0; CURVE_SIZE > adc; ++adc)
+  {
+    float y = evaluateCurve(&curve, curveInput(adc, curve.maxValue)) + 0.5f;
+    if (y > curve.maxValue)
+    {
+      y = curve.maxValue;
+    }
+    if (table[adc] != (uint16_t)y)
+    {
+      printf("table %u is %u, evaluates to %.1f\n", adc, table[adc], y);
+      return 1;
+    }
+  }
+
+  printf("ok\n");
+  return 0;
+}
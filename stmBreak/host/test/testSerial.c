@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+#include "command.h"
+#include "curve.h"
+#include "device.h"
+#include "flash.h"
+#include "host.h"
+#include "protocol.h"
+#include "serial.h"
+#include "cmsis_os.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+/*
+ * Host stand-in over a pty. The device end runs serial.c on the host
+ * USART1 and commandTask() of command.c, with one user flash bank. The
+ * test is the host PC: it uploads a 1000 point curve in frame sized
+ * chunks, sends a corrupted frame that has to be dropped, commits the
+ * curve to its flash bank, selects a function and a filter, checks that
+ * invalid commands are refused and reads telemetry.
+ */
+
+#define TIMEOUT_MS 2000
+
+#define CHUNK_POINTS ((CONFIG_SERIAL_MAX_PAYLOAD - sizeof(CurveDataPayload)) \
+                      / sizeof(uint16_t))
+
+static FlashBank userBank;
+static FlashBank* const userBanks[BF_NR_ITEMS] = { [BF_USER1] = &userBank };
+static Filter leverFilter;
+static volatile BrakeFunction selected = BF_NR_ITEMS;
+static volatile BrakeFunction changed = BF_NR_ITEMS;
+
+/* Commands after the commit and their expected answers */
+static const struct
+{
+  FrameType type;
+  uint8_t argument;
+  uint32_t size;
+  int status;
+} commands[] =
+{
+  { FRAME_SELECT_FUNCTION, BF_LINEAR, sizeof(SelectFunctionPayload), CMD_OK },
+  { FRAME_SELECT_FUNCTION, BF_NR_ITEMS, sizeof(SelectFunctionPayload), CMD_INVALID },
+  { FRAME_SELECT_FILTER, FILTER_NR_ITEMS - 1, sizeof(SelectFilterPayload), CMD_OK },
+  { FRAME_SELECT_FILTER, FILTER_NR_ITEMS, sizeof(SelectFilterPayload), CMD_INVALID },
+  { FRAME_CURVE_DATA, BF_USER2, sizeof(CurveDataPayload), CMD_INVALID },
+  { FRAME_COMMIT_CURVE, BF_USER2, sizeof(CommitCurvePayload), CMD_INVALID },
+  { FRAME_COMMIT_CURVE, BF_USER1, 0, CMD_INVALID },
+  { (FrameType)0x7F, 0, 1, CMD_UNKNOWN }
+};
+
+static int hostFd;
+static uint8_t hostFrame[FRAME_ENCODED_SIZE(CONFIG_SERIAL_MAX_PAYLOAD)];
+static uint32_t hostLength = 0;
+static uint16_t hostSequence = 0;
+
+static void selectFunction(const BrakeFunction function)
+{
+  selected = function;
+}
+
+static void curveChanged(const BrakeFunction function)
+{
+  changed = function;
+}
+
+static const CommandTarget commandTarget =
+{
+  userBanks,
+  &leverFilter,
+  selectFunction,
+  curveChanged
+};
+
+/**
+ * @return 0 if the bytes were written
+ */
+static int hostSend(const FrameType type, const void* payload,
+                    const uint32_t size, const uint8_t corrupt)
+{
+  uint8_t wire[FRAME_ENCODED_SIZE(CONFIG_SERIAL_MAX_PAYLOAD)];
+  const uint32_t length = encodeFrame(type, hostSequence++, payload, size, wire);
+
+  if (corrupt)
+  {
+    wire[length / 2] ^= 0x10;
+  }
+  return write(hostFd, wire, length) != (ssize_t)length;
+}
+
+/**
+ * Read up to the next delimiter and decode.
+ * @return 1 on a valid frame, 0 on timeout
+ */
+static int hostReceive(Frame* frame)
+{
+  struct pollfd readable = { hostFd, POLLIN, 0 };
+  uint8_t byte;
+
+  while (poll(&readable, 1, TIMEOUT_MS) == 1)
+  {
+    if (read(hostFd, &byte, 1) != 1)
+    {
+      return 0;
+    }
+    if (byte != FRAME_DELIMITER)
+    {
+      if (hostLength < sizeof(hostFrame))
+      {
+        hostFrame[hostLength++] = byte;
+      }
+      continue;
+    }
+    const uint32_t length = hostLength;
+    hostLength = 0;
+    if (decodeFrame(hostFrame, length, frame))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Wait for the response to a command, skipping telemetry.
+ * @return CommandStatus, -1 on timeout or a response to another command
+ */
+static int hostResponse(const uint16_t sequence)
+{
+  Frame frame;
+
+  while (hostReceive(&frame))
+  {
+    if (frame.type != FRAME_RESPONSE)
+    {
+      continue;
+    }
+    const ResponsePayload* response = (const ResponsePayload*)frame.payload;
+    if (response->sequence != sequence)
+    {
+      printf("response to %u, expected %u\n", response->sequence, sequence);
+      return -1;
+    }
+    return response->status;
+  }
+  printf("no response to %u\n", sequence);
+  return -1;
+}
+
+static int openPty(int* device)
+{
+  struct termios raw;
+
+  hostFd = posix_openpt(O_RDWR | O_NOCTTY);
+  if ((hostFd < 0) || grantpt(hostFd) || unlockpt(hostFd))
+  {
+    return 1;
+  }
+  *device = open(ptsname(hostFd), O_RDWR | O_NOCTTY);
+  if ((*device < 0) || tcgetattr(*device, &raw))
+  {
+    return 1;
+  }
+  cfmakeraw(&raw);
+  return tcsetattr(*device, TCSANOW, &raw);
+}
+
+int main(void)
+{
+  static uint8_t payload[CONFIG_SERIAL_MAX_PAYLOAD];
+  static uint16_t points[CURVE_USER_POINTS];
+  static uint16_t saved[CURVE_USER_POINTS];
+  static uint8_t code[CURVE_CODE_SIZE];
+  CurveDataPayload* chunk = (CurveDataPayload*)payload;
+  int device;
+  uint64_t start;
+
+  if (openPty(&device))
+  {
+    printf("no pty\n");
+    return 1;
+  }
+
+  setupDevice();
+  setupFlash();
+  setupSerial();
+  userBank = createFlashBank(CURVE_CODE_SIZE, FLASH_8B);
+  setHostUart(device);
+  initFilter(&leverFilter, &filterPresets[0], 0);
+  setupCommands(&commandTarget);
+
+  osThreadDef(commandThread, commandTask, osPriorityNormal, 0, 256);
+  osThreadCreate(osThread(commandThread), NULL);
+
+  for (uint32_t i = 0; CURVE_USER_POINTS > i; ++i)
+  {
+    points[i] = (i * i) / CURVE_USER_POINTS;
+  }
+
+  /* Upload in chunks, each answered before the next is sent */
+  start = getHostTime();
+  for (uint32_t offset = 0; CURVE_USER_POINTS > offset; offset += CHUNK_POINTS)
+  {
+    const uint32_t count = ((CURVE_USER_POINTS - offset) < CHUNK_POINTS)
+                           ? (CURVE_USER_POINTS - offset) : CHUNK_POINTS;
+    chunk->function = BF_USER1;
+    chunk->reserved = 0;
+    chunk->offset = offset;
+    memcpy(chunk->points, &points[offset], count * sizeof(uint16_t));
+
+    /* A corrupted copy first, it must be dropped without a response */
+    if (hostSend(FRAME_CURVE_DATA, payload,
+                 sizeof(CurveDataPayload) + (count * sizeof(uint16_t)), offset == 0)
+        || ((offset == 0)
+            && hostSend(FRAME_CURVE_DATA, payload,
+                        sizeof(CurveDataPayload) + (count * sizeof(uint16_t)), 0))
+        || (hostResponse(hostSequence - 1) != CMD_OK))
+    {
+      printf("upload failed at %u\n", offset);
+      return 1;
+    }
+  }
+  printf("upload of %u points: %.2f ms\n", CURVE_USER_POINTS,
+         (getHostTime() - start) / 1e6);
+
+  payload[0] = BF_USER1;
+  if (hostSend(FRAME_COMMIT_CURVE, payload, sizeof(CommitCurvePayload), 0)
+      || (hostResponse(hostSequence - 1) != CMD_OK))
+  {
+    printf("commit failed\n");
+    return 1;
+  }
+
+  const uint32_t size = readFromFlashBank(code, CURVE_CODE_SIZE, &userBank);
+  if ((decodeCurve(saved, CURVE_USER_POINTS, code, size) != CURVE_USER_POINTS)
+      || memcmp(saved, points, sizeof(points)))
+  {
+    printf("committed curve differs\n");
+    return 1;
+  }
+  if (changed != BF_USER1)
+  {
+    printf("commit of function %u reported\n", changed);
+    return 1;
+  }
+
+  /* One byte argument each, a function without a bank takes no curve */
+  for (uint32_t i = 0; (sizeof(commands) / sizeof(commands[0])) > i; ++i)
+  {
+    memset(payload, 0, sizeof(CurveDataPayload));
+    payload[0] = commands[i].argument;
+    if (hostSend(commands[i].type, payload, commands[i].size, 0))
+    {
+      return 1;
+    }
+    const int status = hostResponse(hostSequence - 1);
+    if (status != commands[i].status)
+    {
+      printf("command %u answered %i, expected %i\n", i, status,
+             commands[i].status);
+      return 1;
+    }
+  }
+  if ((selected != BF_LINEAR)
+      || (leverFilter.coefficients != &filterPresets[FILTER_NR_ITEMS - 1]))
+  {
+    printf("selection not applied\n");
+    return 1;
+  }
+
+  /* Device to host direction, as usartTask sends telemetry */
+  Frame frame;
+  memset(payload, 0xA5, 64);
+  if (!sendFrame(FRAME_TELEMETRY, payload, 64) || !hostReceive(&frame)
+      || (frame.type != FRAME_TELEMETRY) || (frame.size != 64)
+      || memcmp(frame.payload, payload, 64))
+  {
+    printf("telemetry frame lost\n");
+    return 1;
+  }
+
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,202 @@
+#include "store.h"
+#include "device.h"
+#include "host.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Power cuts on the simulated NOR flash. Random records are written and
+ * compacted while a model keeps what every id has to read back. Now and
+ * then the power is cut after a random number of programmed bytes, during
+ * a write or a compaction, and the store is mounted again: an interrupted
+ * write may read back old or new, every other id must be unchanged. A
+ * mount after a whole compaction has to come from the directory. Last, a
+ * damaged record has to read back its previous version, found by the
+ * mount and by a read.
+ */
+
+#define ITERATIONS 8000
+#define IDS        60
+#define MAX_SIZE   2400
+
+static uint8_t model[STORE_MAX_IDS][MAX_SIZE];
+static uint32_t modelSize[STORE_MAX_IDS];
+
+/**
+ * @return 0 if every id reads back as modelled
+ */
+static int checkStore(const uint32_t iteration)
+{
+  static uint8_t data[MAX_SIZE];
+
+  for (uint32_t id = 0; STORE_MAX_IDS > id; ++id)
+  {
+    const uint32_t size = readStore(id, data, sizeof(data));
+    if ((size != modelSize[id]) || memcmp(data, model[id], size))
+    {
+      printf("id %u reads %u bytes, expected %u, iteration %u\n", id, size,
+             modelSize[id], iteration);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Clear a word of a record, as NOR bit rot would.
+ */
+static int damageRecord(const uint32_t id)
+{
+  const uint32_t zero = 0;
+  return !programFlash((uint32_t)mapStore(id, NULL), &zero, 1, 4);
+}
+
+/**
+ * On a fresh store, id 0 has three versions: the first two are in the
+ * directory of the second sector, the third behind it. Damage the second
+ * before a mount and the third before a read, both have to fall back.
+ * @return 0 if the last good version reads back every time
+ */
+static int checkDamage(void)
+{
+  static uint8_t large[60000];
+  static const uint8_t versions[3][4] = { { 1, 1, 1, 1 }, { 2, 2, 2, 2 },
+                                          { 3, 3, 3, 3 } };
+  uint8_t data[4];
+
+  setupHostFlash(0xFF);
+  mountStore();
+  for (uint32_t i = 0; 3 > i; ++i)
+  {
+    if ((i < 2) && !writeStore(0, versions[i], sizeof(versions[i]), 1))
+    {
+      return 1;
+    }
+    /* The third one opens the second sector */
+    if (!writeStore(1, large, sizeof(large), 1))
+    {
+      return 1;
+    }
+  }
+
+  if (damageRecord(0) || mountStore()
+      || (readStore(0, data, sizeof(data)) != sizeof(data))
+      || memcmp(data, versions[0], sizeof(data)))
+  {
+    printf("mount did not fall back to the first version\n");
+    return 1;
+  }
+
+  if (!writeStore(0, versions[2], sizeof(versions[2]), 1) || damageRecord(0)
+      || (readStore(0, data, sizeof(data)) != sizeof(data))
+      || memcmp(data, versions[0], sizeof(data)))
+  {
+    printf("read did not fall back to the first version\n");
+    return 1;
+  }
+  return 0;
+}
+
+int main(void)
+{
+  static uint8_t data[MAX_SIZE];
+  static uint8_t readBack[MAX_SIZE];
+  uint32_t cuts = 0;
+  uint32_t compactions = 0;
+  uint8_t scanned = 0; // the last mount scanned all sectors
+
+  /* Foreign content, the store has to claim its sectors */
+  setupHostFlash(0x5A);
+  mountStore();
+  if (checkStore(0))
+  {
+    return 1;
+  }
+
+  srand(1);
+  for (uint32_t iteration = 0; ITERATIONS > iteration; ++iteration)
+  {
+    const uint32_t id = rand() % IDS;
+    const uint32_t size = (rand() % 4) ? (1 + (rand() % MAX_SIZE))
+                                       : (1 + (rand() % 40));
+    for (uint32_t i = 0; size > i; ++i)
+    {
+      data[i] = rand();
+    }
+
+    if ((rand() % 50) == 0)
+    {
+      setHostFlashBudget(rand() % 3000);
+      writeStore(id, data, size, 1);
+      setHostFlashBudget(-1);
+      cuts++;
+      scanned = !mountStore();
+
+      if ((readStore(id, readBack, sizeof(readBack)) == size)
+          && !memcmp(readBack, data, size))
+      {
+        memcpy(model[id], data, size);
+        modelSize[id] = size;
+      }
+    }
+    else if (writeStore(id, data, size, 1))
+    {
+      memcpy(model[id], data, size);
+      modelSize[id] = size;
+    }
+    else
+    {
+      printf("write failed, iteration %u\n", iteration);
+      return 1;
+    }
+
+    if (storeNeedsCompaction())
+    {
+      if ((rand() % 20) == 0)
+      {
+        setHostFlashBudget(rand() % 200000);
+        compactStore();
+        setHostFlashBudget(-1);
+        cuts++;
+        scanned = !mountStore();
+      }
+      else if (compactStore())
+      {
+        /* Only a cut the last mount had to scan for may still show */
+        const uint8_t indexed = mountStore();
+        if (!indexed && !scanned)
+        {
+          printf("mount after compaction scanned all sectors, iteration %u\n",
+                 iteration);
+          return 1;
+        }
+        scanned = !indexed;
+        compactions += indexed;
+      }
+    }
+    if ((rand() % 200) == 0)
+    {
+      scanned = !mountStore();
+    }
+    if (checkStore(iteration))
+    {
+      return 1;
+    }
+  }
+
+  printf("%u writes, %u power cuts, %u mounts from the directory after a "
+         "compaction, erases:", ITERATIONS, cuts, compactions);
+  for (uint32_t sector = 5; 12 > sector; ++sector)
+  {
+    printf(" %u", getHostFlashErases(sector));
+  }
+  printf("\n");
+
+  if (checkDamage())
+  {
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -84,6 +84,7 @@
 
 /* USER CODE BEGIN Includes */   	      
 /* Section where include file can be added */
+#include "config.h"
 /* USER CODE END Includes */ 
 
 /* Ensure stdint is only used by the compiler, and not the assembler. */
@@ -99,7 +100,8 @@
 #define configTICK_RATE_HZ                       ((TickType_t)1000)
 #define configMAX_PRIORITIES                     ( 7 )
 #define configMINIMAL_STACK_SIZE                 ((uint16_t)128)
-#define configTOTAL_HEAP_SIZE                    ((size_t)15360)
+#define configTOTAL_HEAP_SIZE                    ((size_t)4096) /* control blocks, idle stack, sync objects */
+#define configAPPLICATION_ALLOCATED_HEAP          CONFIG_USE_CCM /* ucHeap in main.c */
 #define configMAX_TASK_NAME_LEN                  ( 16 )
 #define configUSE_TRACE_FACILITY                 1
 #define configUSE_16_BIT_TICKS                   0
@@ -163,6 +165,35 @@ standard names. */
 
 /* USER CODE BEGIN Defines */   	      
 /* Section where parameter definitions can be added (for instance, to override default ones in FreeRTOS.h) */
+
+/* Per task CPU time on the DWT cycle counter, started by setupDevice(),
+   or on TIM5 under QEMU, see QEMU_Init(). The 32 bit counter wraps after
+   2^32 cycles, read the stats before that. */
+#define configGENERATE_RUN_TIME_STATS            CONFIG_USE_RUNTIME_STATS
+#if CONFIG_USE_RUNTIME_STATS
+ #define configUSE_STATS_FORMATTING_FUNCTIONS    1
+ #define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
+ #if CONFIG_USE_QEMU
+  #define portGET_RUN_TIME_COUNTER_VALUE()       ( *( volatile uint32_t * ) 0x40000C24 ) /* TIM5->CNT */
+ #else
+  #define portGET_RUN_TIME_COUNTER_VALUE()       ( *( volatile uint32_t * ) 0xE0001004 ) /* DWT->CYCCNT */
+ #endif
+#endif
+/* Tickless idle, the idle task sleeps in WFI with the RTOS tick and the HAL
+   tick on TIM7 stopped, see suppressTicksAndSleep(). In release builds the
+   DWT counter stops in sleep with the core clock, so run time stats count
+   the cycles awake. Debug builds set DBG_SLEEP, the core clock and the
+   counter keep running and the sleep counts for the idle task. */
+#define configUSE_TICKLESS_IDLE                  CONFIG_USE_TICKLESS_IDLE
+#if CONFIG_USE_TICKLESS_IDLE && (defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__))
+ void suppressTicksAndSleep(uint32_t expectedIdleTime);
+ #define portSUPPRESS_TICKS_AND_SLEEP( xExpectedIdleTime ) suppressTicksAndSleep( xExpectedIdleTime )
+#endif
+/* Stacks and pools of osThreadStaticDef() and osPoolStaticDef(), listed as
+   .bss.CCMRAM.os in the map file, next to ucHeap when in CCM. */
+#if CONFIG_USE_CCM
+ #define osStaticSection                         ".bss.CCMRAM.os"
+#endif
 /* USER CODE END Defines */ 
 
 #endif /* FREERTOS_CONFIG_H */
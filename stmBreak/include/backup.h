@@ -0,0 +1,20 @@
+#ifndef __BACKUP_H
+#define __BACKUP_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define BACKUP_MAX_SIZE 240 // bytes of a record
+
+void setupBackup(void);
+uint32_t loadBackup(void* data, const uint32_t size);
+uint8_t saveBackup(const void* data, const uint32_t size);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __BACKUP_H */
@@ -0,0 +1,20 @@
+#ifndef __BENCHMARK_H
+#define __BENCHMARK_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+
+void runBenchmarks(void);
+void runTickTest(void);
+void reportRuntimeStats(const uint32_t controlIterations,
+                        const uint32_t controlCycles,
+                        const uint32_t firstPwmCycles);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __BENCHMARK_H */
@@ -0,0 +1,34 @@
+#ifndef __COMMAND_H
+#define __COMMAND_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "main.h"
+#include "filter.h"
+#include "flash.h"
+#include "protocol.h"
+#include <stdint.h>
+
+/* Called from commandTask, or from the flash task after a commit */
+typedef void (*FunctionHandler)(const BrakeFunction function);
+
+/* What the commands act on, owned by the caller of setupCommands() */
+typedef struct CommandTarget
+{
+  FlashBank* const* userBank;      // per BrakeFunction, NULL without user data
+  Filter* leverFilter;             // FRAME_SELECT_FILTER
+  FunctionHandler selectFunction;  // FRAME_SELECT_FUNCTION
+  FunctionHandler curveChanged;    // a user curve was committed
+} CommandTarget;
+
+void setupCommands(const CommandTarget* target);
+CommandStatus executeCommand(const Frame* frame);
+void commandTask(void const* argument);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __COMMAND_H */
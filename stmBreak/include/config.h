@@ -0,0 +1,64 @@
+#ifndef __CONFIG_H
+#define __CONFIG_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Acquisition ---------------------------------------------------------------*/
+#define CONFIG_ADC_SAMPLE_RATE_HZ     10000 /* TIM2 trigger rate of ADC1 */
+#define CONFIG_ADC_SAMPLE_RATE_MIN_HZ 1000
+#define CONFIG_ADC_SAMPLE_RATE_MAX_HZ 50000
+#define CONFIG_ADC_BLOCK_SIZE         16    /* samples per DMA half buffer */
+#define CONFIG_ADC_DMA_IRQ_PRIORITY   6     /* may call FreeRTOS FromISR API */
+
+/* Lever filter, see filterPresets -------------------------------------------*/
+#define CONFIG_FILTER_PRESET          FILTER_LIGHT
+
+/* Control loop --------------------------------------------------------------*/
+#define CONFIG_CONTROL_IRQ_PRIORITY   5     /* TIM1 update, highest FromISR level */
+#define CONFIG_CURVE_UPDATE_PERIOD_MS 100   /* limit changes are picked up after */
+#define CONFIG_CONTROL_IN_RAM         1     /* control path and its ISRs from RAM, 0 freezes the PWM during flash erases */
+#define CONFIG_CURVE_CACHE_SIZE       4     /* built duty cycle tables, 8K each, at least 2 */
+
+/* Telemetry -----------------------------------------------------------------*/
+#define CONFIG_TELEMETRY_RING_SIZE    256   /* samples, power of two */
+#define CONFIG_TELEMETRY_BATCH_SIZE   32    /* samples per read by usartTask */
+#define CONFIG_TELEMETRY_PERIOD_MS    10
+
+/* Serial link, USART1 -------------------------------------------------------*/
+#define CONFIG_UART_BAUD_RATE         460800 /* telemetry budget, see serial.c */
+#define CONFIG_UART_RX_BUFFER_SIZE    1024  /* circular DMA ring, bytes */
+#define CONFIG_UART_IRQ_PRIORITY      7
+#define CONFIG_SERIAL_MAX_PAYLOAD     256   /* bytes per frame, both directions */
+
+/* Inputs, see input.c ------------------------------------------------------*/
+#define CONFIG_INPUT_DEBOUNCE_MS      20    /* line stable for, before it is read */
+#define CONFIG_INPUT_LONG_PRESS_MS    1000
+
+/* Parameter flash -----------------------------------------------------------*/
+#define CONFIG_FLASH_IRQ_PRIORITY     8     /* end of operation, wakes the flash task */
+#define CONFIG_FLASH_COMMIT_QUEUE_SIZE 4    /* pending commitToFlashBank() requests */
+
+/* Scheduler ---------------------------------------------------------------*/
+#define CONFIG_USE_TICKLESS_IDLE      1     /* idle sleeps in WFI without RTOS and HAL ticks */
+
+/* Memory placement, see section.h -----------------------------------------*/
+#define CONFIG_USE_CCM                1     /* task stacks, queues and control data in CCM */
+
+/* Diagnostics ---------------------------------------------------------------*/
+#define CONFIG_USE_BENCHMARKS         0     /* run runBenchmarks() before the scheduler */
+#define CONFIG_USE_PROBES             0     /* DWT stage probes, read by FRAME_READ_PROBES */
+#define CONFIG_USE_PROBE_HISTOGRAM    0     /* log2 histograms, costs the probes a CLZ and a store */
+#define CONFIG_USE_RUNTIME_STATS      0     /* FreeRTOS per task CPU time on the DWT counter */
+#define CONFIG_RUNTIME_STATS_PERIOD_MS 10000 /* reportRuntimeStats() from curveTask */
+#define CONFIG_USE_SCRIPTED_ADC       0     /* replace ADC1 by a triangle sweep, see device.c */
+#define CONFIG_SCRIPTED_ADC_STEP      4     /* ADC codes per sample of the sweep */
+#define CONFIG_USE_QEMU               0     /* TIM3 and TIM5 stand in for TIM1 and the DWT, see qemu/perf.py */
+#define CONFIG_USE_TICK_TEST          0     /* runTickTest() from curveTask, see qemu/ticks.py */
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __CONFIG_H */
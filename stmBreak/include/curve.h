@@ -0,0 +1,53 @@
+#ifndef __CURVE_H
+#define __CURVE_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "main.h"
+#include <stdint.h>
+
+#define CURVE_SIZE        4096 // one entry per 12-bit ADC code
+#define CURVE_USER_POINTS 1000 // items of a user curve
+
+/* Worst case encodeCurve() size of CURVE_USER_POINTS points */
+#define CURVE_CODE_SIZE   (5 + (3 * CURVE_USER_POINTS))
+
+typedef struct Curve
+{
+  BrakeFunction function;
+  uint32_t minValue;
+  uint32_t maxValue;
+  const uint8_t* userData;  // encoded user curve, BF_USER* only
+  uint32_t userSize;        // bytes of userData
+  const uint16_t* userPoints; // decoded user curve for evaluateCurve(), may be NULL
+} Curve;
+
+/* Position of a streaming decode, see nextCurvePoint() */
+typedef struct CurveDecoder
+{
+  const uint8_t* data;
+  const uint8_t* end;
+  uint32_t remaining;       // points left
+  uint32_t run;             // points left of a zero run
+  int32_t value;
+  int32_t delta;
+} CurveDecoder;
+
+float curveInput(const uint32_t adcRaw, const uint32_t maxValue);
+float evaluateCurve(const Curve* curve, const float x);
+void buildCurveTable(uint16_t* table, const Curve* curve);
+uint32_t encodeCurve(uint8_t* data, const uint32_t capacity,
+                     const uint16_t* points, const uint32_t count);
+void initCurveDecoder(CurveDecoder* decoder, const uint8_t* data,
+                      const uint32_t size);
+uint8_t nextCurvePoint(CurveDecoder* decoder, uint16_t* point);
+uint32_t decodeCurve(uint16_t* points, const uint32_t count,
+                     const uint8_t* data, const uint32_t size);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __CURVE_H */
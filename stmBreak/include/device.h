@@ -5,13 +5,48 @@
  extern "C" {
 #endif
 
+#include "config.h"
+#include "section.h"
 #include <stdint.h>
 
+typedef void (*AdcBlockHandler)(const uint16_t* samples, uint32_t count);
+typedef void (*UartTxHandler)(void);
+typedef void (*UartRxHandler)(void);
+typedef void (*FlashWaitHandler)(void);
+typedef void (*FlashDoneHandler)(void);
+
 void setupDevice(void);
 
-void setPwm(uint32_t dutyCycle);
+void CONTROL_FUNC setPwm(uint32_t dutyCycle);
+void startControlLoop(void);
 uint32_t getAdc(void);
-void uartSend(void* data, uint16_t size);
+uint32_t setAdcSampleRate(uint32_t rateHz);
+void setAdcBlockHandler(AdcBlockHandler handler);
+#if CONFIG_CONTROL_IN_RAM
+void CONTROL_FUNC adcDmaInterrupt(void);
+#endif
+uint8_t uartSend(const void* data, uint16_t size);
+void setUartTxHandler(UartTxHandler handler);
+uint32_t uartReceive(void* data, uint32_t size);
+void setUartRxHandler(UartRxHandler handler);
+void uartRxIdle(void);
+uint32_t getFlashSector(uint32_t address);
+uint32_t getFlashSectorAddress(uint32_t sector);
+uint32_t getFlashSectorSize(uint32_t sector);
+uint8_t eraseFlash(uint32_t firstSector, uint32_t count);
+uint8_t programFlash(uint32_t address, const void* data, uint32_t size,
+                     uint32_t itemSize);
+uint32_t getFlashError(void);
+void setFlashWaitHandler(FlashWaitHandler handler);
+void setFlashDoneHandler(FlashDoneHandler handler);
+void flashEndOfOperation(void);
+uint32_t computeCrc(const void* data, const uint32_t size, const uint32_t crc);
+
+#if CONFIG_USE_SCRIPTED_ADC
+void scriptedAdcSample(void);
+#endif
+
+uint32_t CONTROL_FUNC getCycleCount(void);
 uint8_t isButtonOnBoardPressed(void);
 void ledOnBoardOn(void);
 void ledOnBoardOff(void);
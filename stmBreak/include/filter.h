@@ -0,0 +1,51 @@
+#ifndef __FILTER_H
+#define __FILTER_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "section.h"
+#include <stdint.h>
+
+typedef enum FilterPreset
+{
+  FILTER_OFF,
+  FILTER_LIGHT,
+  FILTER_MEDIUM,
+  FILTER_HEAVY,
+
+  FILTER_NR_ITEMS
+} FilterPreset;
+
+/* Alpha that skips the IIR, the output is the decimated input */
+#define FILTER_BYPASS 0x7FFF
+
+typedef struct FilterCoefficients
+{
+  uint32_t oversampling; // log2 of the decimation factor, 0..4
+  int16_t alpha;         // IIR smoothing factor in Q15, or FILTER_BYPASS
+} FilterCoefficients;
+
+typedef struct Filter
+{
+  const FilterCoefficients* volatile coefficients;
+  int32_t state;         // IIR output, ADC code in Q16
+  uint32_t partialSum;   // samples of a window the last block left open
+  uint32_t partialCount;
+} Filter;
+
+extern const FilterCoefficients filterPresets[FILTER_NR_ITEMS];
+
+void initFilter(Filter* filter, const FilterCoefficients* coefficients,
+                const uint32_t initialValue);
+void setFilterCoefficients(Filter* filter,
+                           const FilterCoefficients* coefficients);
+uint32_t CONTROL_FUNC filterBlock(Filter* filter, const uint16_t* samples,
+                     const uint32_t count);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __FILTER_H */
@@ -17,19 +17,32 @@ typedef enum FlashSize
 
 typedef struct FlashBank
 {
-  uint32_t id;        // bank id
-  uint32_t sector;    // flash sector
+  uint32_t id;        // bank id, its record in the store
   uint32_t size;      // in items
   FlashSize itemSize; // FLASH_8B, FLASH_16B, FLASH_32B, FLASH_64B
 } FlashBank;
 
+/* Result of a commitToFlashBank(), called from the flash task */
+typedef void (*FlashCommitHandler)(const FlashBank* bank, uint8_t written,
+                                   void* context);
+
+/* Set while the flash task writes a commit and compacts, the control loop
+ * records PROBE_COMMIT_CONTROL_PERIOD meanwhile */
+extern volatile uint8_t flashCommitActive;
+
 void setupFlash(void);
 FlashBank createFlashBank(const uint32_t size, const FlashSize itemSize);
-void readFromFlashBank(void* data, const uint32_t size,
-                       const FlashBank* bank);
-void writeToFlashBank(void* data, const uint32_t size,
-                      const FlashBank* bank);
-//void eraseFromFlashBank(const uint32_t size, const FlashBank* bank, const uint32_t offset);
+uint32_t readFromFlashBank(void* data, const uint32_t size,
+                           const FlashBank* bank);
+uint8_t writeToFlashBank(const void* data, const uint32_t size,
+                         const FlashBank* bank);
+uint8_t commitToFlashBank(const void* data, const uint32_t size,
+                          const FlashBank* bank, FlashCommitHandler handler,
+                          void* context);
+const void* mapFlashBank(const FlashBank* bank, uint32_t* size);
+uint8_t openFlashBank(const uint32_t id, FlashBank* bank);
+void lockFlash(void);
+void unlockFlash(void);
 
 #ifdef __cplusplus
  }
@@ -0,0 +1,50 @@
+#ifndef __INPUT_H
+#define __INPUT_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "cmsis_os.h"
+#include <stdint.h>
+
+typedef enum InputId
+{
+  INPUT_USER_BUTTON = 0, // PA0, on board
+  INPUT_MODE_DOWN,       // PC3, previous brake function
+  INPUT_MODE_UP,         // PA4, next brake function
+  INPUT_AUX,             // PA2
+
+  INPUT_NR_ITEMS
+} InputId;
+
+typedef enum InputEvent
+{
+  INPUT_PRESS = 0,
+  INPUT_LONG_PRESS,      // held for CONFIG_INPUT_LONG_PRESS_MS
+  INPUT_RELEASE,
+
+  INPUT_EVENT_NR_ITEMS
+} InputEvent;
+
+/* Signal of an event, as set on the subscribed task, see osSignalWait() */
+#define INPUT_SIGNAL(id, event) \
+  (1u << (((id) * INPUT_EVENT_NR_ITEMS) + (event)))
+
+/* All signals of an input */
+#define INPUT_SIGNALS(id) \
+  (((1u << INPUT_EVENT_NR_ITEMS) - 1) << ((id) * INPUT_EVENT_NR_ITEMS))
+
+#if (INPUT_NR_ITEMS * INPUT_EVENT_NR_ITEMS) > 31
+#error "Input signals do not fit the 31 bits of osSignalWait()"
+#endif
+
+void setupInput(void);
+void subscribeInput(const InputId id, osThreadId task);
+void inputEdge(const uint16_t pin);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __INPUT_H */
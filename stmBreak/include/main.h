@@ -5,6 +5,7 @@
  extern "C" {
 #endif
 
+#include "section.h"
 #include <stdint.h>
 
 typedef enum BrakeFunction
@@ -27,6 +28,9 @@ typedef enum BrakeFunction
   BF_NR_ITEMS
 } BrakeFunction;
 
+void CONTROL_FUNC controlLoop(void);
+void requestCurveUpdate(void);
+
 #ifdef __cplusplus
  }
 #endif
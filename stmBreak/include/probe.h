@@ -0,0 +1,111 @@
+#ifndef __PROBE_H
+#define __PROBE_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "config.h"
+#include <stdint.h>
+
+/* Measured stages, each probe may only be used from one context */
+typedef enum ProbeId
+{
+  PROBE_ACQUISITION = 0, // ADC block filter, DMA interrupt
+  PROBE_CONTROL_LOOP,    // whole control loop, TIM1 update interrupt
+  PROBE_CURVE_LOOKUP,    // duty cycle table lookup
+  PROBE_SET_PWM,
+  PROBE_TELEMETRY,       // telemetry ring push
+  PROBE_CURVE_BUILD,     // duty cycle table rebuild, curveTask
+  PROBE_FRAME_ENCODE,    // frame encode in sendFrame(), under its lock
+  PROBE_CONTROL_PERIOD,  // between two control loops, max is the worst PWM update gap
+  PROBE_INPUT_EDGE,      // EXTI interrupt of a button, see input.c
+  PROBE_COMMIT_CONTROL_PERIOD, // PROBE_CONTROL_PERIOD while the flash task commits
+  PROBE_NR_ITEMS
+} ProbeId;
+
+/* Bucket n counts durations of 2^n to 2^(n+1)-1 cycles, 0 and 1 go to 0 */
+#define PROBE_BUCKETS 32
+
+/* Cycles a PROBE_BEGIN/PROBE_END pair may add, see benchmarkProbes() */
+#define PROBE_BUDGET_CYCLES 10
+
+typedef struct ProbeStats
+{
+  uint32_t count;
+  uint32_t min;                      // cycles
+  uint32_t max;                      // cycles
+  uint32_t sum;                      // cycles, wraps, mean is sum / count
+  uint32_t histogram[PROBE_BUCKETS]; // zero without CONFIG_USE_PROBE_HISTOGRAM
+} ProbeStats;
+
+/* Payload of a FRAME_PROBE frame, 32 bit fields only so no padding */
+typedef struct ProbeReport
+{
+  uint32_t id;                       // ProbeId
+  ProbeStats stats;
+} ProbeReport;
+
+#if CONFIG_USE_PROBES
+
+#include "cmsis_device.h"
+
+/*
+ * PROBE_BEGIN(PROBE_X) ... PROBE_END(PROBE_X) within one block measures
+ * the cycles between the two markers with the DWT cycle counter, which
+ * setupDevice() starts.
+ */
+#define PROBE_BEGIN(id) const uint32_t probeStart_##id = DWT->CYCCNT
+#define PROBE_END(id)   recordProbe((id), DWT->CYCCNT - probeStart_##id)
+
+typedef struct ProbeData
+{
+  uint32_t count;                    // 0 with the histogram, counted there
+  uint32_t sum;
+  uint32_t min;
+  uint32_t max;
+#if CONFIG_USE_PROBE_HISTOGRAM
+  uint32_t histogram[PROBE_BUCKETS];
+#endif
+} ProbeData;
+
+extern ProbeData probeData[PROBE_NR_ITEMS];
+
+/* 32 bit sum, it wraps after 2^32 cycles of one probe, read and reset
+ * before. Without the histogram a pair costs about 20 cycles on the
+ * Cortex-M4: two counter reads and four load, update, store. */
+static inline void recordProbe(const ProbeId id, const uint32_t cycles)
+{
+  ProbeData* data = &probeData[id];
+
+#if CONFIG_USE_PROBE_HISTOGRAM
+  data->histogram[31 - __CLZ(cycles | 1)]++;
+#else
+  data->count++;
+#endif
+  data->sum += cycles;
+  if (cycles < data->min)
+  {
+    data->min = cycles;
+  }
+  if (cycles > data->max)
+  {
+    data->max = cycles;
+  }
+}
+
+void resetProbes(void);
+void readProbe(const ProbeId id, ProbeStats* stats);
+
+#else
+
+#define PROBE_BEGIN(id)
+#define PROBE_END(id)
+
+#endif /* CONFIG_USE_PROBES */
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __PROBE_H */
@@ -0,0 +1,108 @@
+#ifndef __PROTOCOL_H
+#define __PROTOCOL_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Frame layout before COBS encoding, little endian:
+ *   type (1) | sequence (2) | payload (n) | CRC-16/CCITT over all before (2)
+ * On the wire the encoded frame is terminated by a single 0x00.
+ */
+#define FRAME_HEADER_SIZE   3
+#define FRAME_CRC_SIZE      2
+#define FRAME_DELIMITER     0x00
+
+#define CRC16_INIT          0xFFFF
+#define CRC32_INIT          0xFFFFFFFF
+
+/* Worst case wire size of a frame carrying size payload bytes */
+#define FRAME_ENCODED_SIZE(size) \
+  ((FRAME_HEADER_SIZE + (size) + FRAME_CRC_SIZE) \
+   + ((FRAME_HEADER_SIZE + (size) + FRAME_CRC_SIZE) / 254) + 2)
+
+typedef enum FrameType
+{
+  /* Device to host */
+  FRAME_TELEMETRY = 0x01,       // TelemetrySample[]
+  FRAME_RESPONSE = 0x02,        // ResponsePayload, one per command frame
+  FRAME_PROBE = 0x03,           // ProbeReport, see probe.h
+
+  /* Host to device */
+  FRAME_CURVE_DATA = 0x10,      // CurveDataPayload
+  FRAME_SELECT_FUNCTION = 0x11, // SelectFunctionPayload
+  FRAME_COMMIT_CURVE = 0x12,    // CommitCurvePayload
+  FRAME_READ_PROBES = 0x13,     // ReadProbesPayload, one FRAME_PROBE per probe
+  FRAME_SELECT_FILTER = 0x14    // SelectFilterPayload
+} FrameType;
+
+typedef enum CommandStatus
+{
+  CMD_OK = 0,
+  CMD_UNKNOWN,   // unknown frame type
+  CMD_INVALID,   // malformed payload or out of range argument
+  CMD_FAILED,
+  CMD_BUSY,      // a commit is still being written, retry later
+  CMD_PENDING = 0xFF // not sent, the response follows once the command completed
+} CommandStatus;
+
+typedef struct Frame
+{
+  FrameType type;
+  uint16_t sequence;
+  const uint8_t* payload;
+  uint32_t size;
+} Frame;
+
+/* Payloads are packed, the payload of a received frame is unaligned */
+typedef struct __attribute__((packed)) ResponsePayload
+{
+  uint16_t sequence; // of the command frame
+  uint8_t type;      // of the command frame
+  uint8_t status;    // CommandStatus
+} ResponsePayload;
+
+typedef struct __attribute__((packed)) CurveDataPayload
+{
+  uint8_t function;  // BF_USER1..BF_USER3
+  uint8_t reserved;
+  uint16_t offset;   // first point, points of a curve can come in chunks
+  uint16_t points[]; // up to the end of the payload
+} CurveDataPayload;
+
+typedef struct __attribute__((packed)) SelectFunctionPayload
+{
+  uint8_t function;  // BrakeFunction
+} SelectFunctionPayload;
+
+typedef struct __attribute__((packed)) CommitCurvePayload
+{
+  uint8_t function;  // BF_USER1..BF_USER3, written to its flash bank
+} CommitCurvePayload;
+
+typedef struct __attribute__((packed)) ReadProbesPayload
+{
+  uint8_t reset;     // clear the probes after reading
+} ReadProbesPayload;
+
+typedef struct __attribute__((packed)) SelectFilterPayload
+{
+  uint8_t preset;    // FilterPreset, applies from the next ADC block
+} SelectFilterPayload;
+
+uint16_t crc16(const uint8_t* data, const uint32_t size, uint16_t crc);
+uint32_t crc32(const uint8_t* data, const uint32_t size, uint32_t crc);
+uint32_t cobsEncode(const uint8_t* data, const uint32_t size, uint8_t* out);
+uint32_t cobsDecode(const uint8_t* data, const uint32_t size, uint8_t* out);
+uint32_t encodeFrame(const FrameType type, const uint16_t sequence,
+                     const void* payload, const uint32_t size, uint8_t* out);
+uint32_t decodeFrame(uint8_t* data, const uint32_t size, Frame* frame);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __PROTOCOL_H */
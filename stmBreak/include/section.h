@@ -0,0 +1,64 @@
+#ifndef __SECTION_H
+#define __SECTION_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "config.h"
+
+/*
+ * Placement of code and constants outside of the flash. The startup code
+ * copies .ramfunc and .data from the flash to RAM, see sections.ld.
+ * Put the macro on the prototype as well, so callers use a long call.
+ */
+
+/* Code that runs from RAM, e.g. while the flash is busy. The host build
+ * has no long call and nothing to place. */
+#ifdef __arm__
+#define RAMFUNC __attribute__((section(".ramfunc"), noinline, long_call))
+#else
+#define RAMFUNC
+#endif
+
+/*
+ * The control path, its interrupts and the constants it reads. With
+ * CONFIG_CONTROL_IN_RAM they run from RAM, so the PWM can keep updating
+ * while a flash erase or program stalls all fetches from the flash, see
+ * flashTask(). Without it the PWM holds its duty cycle for the whole erase.
+ * Their static inline helpers have to be inlined, so build with -O1 or
+ * above.
+ */
+#if CONFIG_CONTROL_IN_RAM
+#define CONTROL_FUNC  RAMFUNC
+#define CONTROL_CONST __attribute__((section(".data.control")))
+#else
+#define CONTROL_FUNC
+#define CONTROL_CONST
+#endif
+
+/*
+ * Data in the 64K core coupled memory. CCM is on the D-bus of the core
+ * only: zero wait states and no contention with DMA, but neither DMA nor
+ * instruction fetches reach it. Never put DMA buffers or code there.
+ * CCM_DATA is copied from the flash, CCM_BSS zeroed, CCM_NOINIT left alone
+ * by the startup, see the regions arrays in sections.ld.
+ */
+#if CONFIG_USE_CCM
+#if !defined(OS_INCLUDE_STARTUP_INIT_MULTIPLE_RAM_SECTIONS)
+#error "CONFIG_USE_CCM needs OS_INCLUDE_STARTUP_INIT_MULTIPLE_RAM_SECTIONS, see _startup.c"
+#endif
+#define CCM_DATA   __attribute__((section(".data.CCMRAM")))
+#define CCM_BSS    __attribute__((section(".bss.CCMRAM")))
+#define CCM_NOINIT __attribute__((section(".noinit.CCMRAM")))
+#else
+#define CCM_DATA
+#define CCM_BSS
+#define CCM_NOINIT
+#endif
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __SECTION_H */
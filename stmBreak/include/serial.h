@@ -0,0 +1,20 @@
+#ifndef __SERIAL_H
+#define __SERIAL_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "protocol.h"
+#include <stdint.h>
+
+void setupSerial(void);
+uint32_t sendFrame(const FrameType type, const void* payload,
+                   const uint32_t size);
+uint32_t receiveFrame(Frame* frame, const uint32_t timeout);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __SERIAL_H */
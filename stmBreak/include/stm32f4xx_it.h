@@ -5,6 +5,19 @@
  extern "C" {
 #endif 
 
+#include "config.h"
+#include "section.h"
+#include <stdint.h>
+
+#if CONFIG_USE_TICKLESS_IDLE
+/* SysTick and TIM7 interrupts, see suppressTicksAndSleep() */
+extern volatile uint32_t sysTickCount;
+extern volatile uint32_t halTickCount;
+
+void suppressTicksAndSleep(uint32_t expectedIdleTime);
+uint32_t getSuppressedTicks(void);
+#endif
+
 /* Exported functions ------------------------------------------------------- */
 void NMI_Handler(void);
 void HardFault_Handler(void);
@@ -15,6 +28,16 @@ void DebugMon_Handler(void);
 void SysTick_Handler(void);
 
 void TIM2_IRQHandler(void);
+void CONTROL_FUNC TIM1_UP_TIM10_IRQHandler(void);
+#if CONFIG_USE_QEMU
+void CONTROL_FUNC TIM3_IRQHandler(void);
+#endif
+void CONTROL_FUNC DMA2_Stream0_IRQHandler(void);
+void DMA2_Stream2_IRQHandler(void);
+void DMA2_Stream7_IRQHandler(void);
+void USART1_IRQHandler(void);
+void FLASH_IRQHandler(void);
+void EXTI0_IRQHandler(void);
 void EXTI2_IRQHandler(void);
 void EXTI3_IRQHandler(void);
 void EXTI4_IRQHandler(void);
@@ -0,0 +1,28 @@
+#ifndef __STORE_H
+#define __STORE_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define STORE_MAX_IDS 64 // record ids 0..STORE_MAX_IDS-1
+
+uint8_t mountStore(void);
+uint32_t readStore(const uint32_t id, void* data, const uint32_t size);
+uint32_t getStoreSize(const uint32_t id);
+uint32_t getStoreItemSize(const uint32_t id);
+const void* mapStore(const uint32_t id, uint32_t* size);
+uint8_t writeStore(const uint32_t id, const void* data, const uint32_t size,
+                   const uint32_t itemSize);
+uint8_t storeNeedsCompaction(void);
+uint8_t compactStore(void);
+uint8_t beginCompaction(uint32_t* sector);
+uint8_t endCompaction(const uint32_t sector);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __STORE_H */
@@ -0,0 +1,45 @@
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "config.h"
+#include "section.h"
+#include <stdint.h>
+
+#define TELEMETRY_LINE_SIZE 32 // keeps producer and consumer indices apart
+
+#if (CONFIG_TELEMETRY_RING_SIZE & (CONFIG_TELEMETRY_RING_SIZE - 1)) != 0
+#error "CONFIG_TELEMETRY_RING_SIZE must be a power of two"
+#endif
+
+typedef struct TelemetrySample
+{
+  uint32_t timestamp; // core cycles, see getCycleCount()
+  uint16_t adcValue;  // filtered lever position
+  uint16_t dutyCycle; // CCR2 written for this sample
+} TelemetrySample;
+
+/* Single producer, single consumer ring, indices run freely and wrap */
+typedef struct TelemetryRing
+{
+  volatile uint32_t head __attribute__((aligned(TELEMETRY_LINE_SIZE)));
+  volatile uint32_t overruns; // written by the producer only
+  volatile uint32_t tail __attribute__((aligned(TELEMETRY_LINE_SIZE)));
+  TelemetrySample samples[CONFIG_TELEMETRY_RING_SIZE]
+    __attribute__((aligned(TELEMETRY_LINE_SIZE)));
+} TelemetryRing;
+
+void initTelemetry(TelemetryRing* ring);
+uint32_t CONTROL_FUNC pushTelemetry(TelemetryRing* ring, const TelemetrySample* sample);
+uint32_t readTelemetry(TelemetryRing* ring, TelemetrySample* samples,
+                       const uint32_t count);
+uint32_t getTelemetryLevel(const TelemetryRing* ring);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __TELEMETRY_H */
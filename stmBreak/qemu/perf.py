@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""Performance regression run of the firmware under QEMU.
+
+Boots the stmBreak ELF headless on the netduinoplus2 machine, an STM32F405,
+with -icount shift=0, so one instruction takes one ns of virtual time and
+every run executes the same instructions. Build the image with
+
+    CONFIG_USE_QEMU          1   TIM3 runs the control loop, TIM5 counts
+    CONFIG_USE_SCRIPTED_ADC  1   the ADC input is a fixed triangle sweep
+    CONFIG_USE_RUNTIME_STATS 1   reportRuntimeStats() over semihosting
+
+QEMU clocks TIM5 at 1 GHz of virtual time, so with shift=0 the firmware's
+"cycles" are instructions, idle time included. reportRuntimeStats() output
+is turned into three metrics:
+
+    instructions per control iteration
+    instructions from reset to the first PWM update
+    share of every task in the run time counter
+
+The machine models neither DMA nor the flash controller, so the UART
+telemetry stalls and flash commits never finish; the numbers compare builds
+with each other, not with the hardware.
+
+    perf.py Debug/stmBreak.elf --save baseline.json
+    perf.py Debug/stmBreak.elf --baseline baseline.json
+    perf.py --log run.txt                  parse a saved run instead
+"""
+
+import argparse
+import json
+import re
+import subprocess
+import sys
+
+CONTROL = re.compile(r"control: (\d+) iterations, (\d+) cycles, "
+                     r"first PWM after (\d+) cycles")
+TASK_HEADER = re.compile(r"^task\s+cycles\s+share")
+TASK = re.compile(r"^(.+?)\s+(\d+)\s+(<1|\d+)%")
+
+
+def qemuCommand(args):
+    return [args.qemu, "-M", "netduinoplus2",
+            "-display", "none", "-serial", "null", "-monitor", "none",
+            "-icount", "shift=0,align=off,sleep=off",
+            "-semihosting-config", "enable=on,target=native",
+            "-kernel", args.elf]
+
+
+def parseReports(lines, reports):
+    """
+    @param lines output of the firmware
+    @param reports stop after that many reports
+    @return last report, None if there was none
+    """
+    report = None
+    count = 0
+    inTasks = False
+
+    for line in lines:
+        line = line.rstrip("\r\n")
+        match = CONTROL.search(line)
+        if match:
+            report = {"iterations": int(match.group(1)),
+                      "controlCycles": int(match.group(2)),
+                      "firstPwm": int(match.group(3)),
+                      "tasks": {}}
+            continue
+        if report is not None and TASK_HEADER.match(line):
+            inTasks = True
+            continue
+        if inTasks:
+            match = TASK.match(line)
+            if match:
+                report["tasks"][match.group(1).strip()] = int(match.group(2))
+                continue
+            inTasks = False
+            count += 1
+            if count >= reports:
+                break
+    if inTasks:
+        count += 1
+    return report if count else None
+
+
+def runQemu(args):
+    process = subprocess.Popen(qemuCommand(args), stdout=subprocess.PIPE,
+                               stderr=subprocess.STDOUT,
+                               universal_newlines=True)
+
+    def lines():
+        for line in process.stdout:
+            if args.verbose:
+                sys.stdout.write(line)
+            yield line
+
+    try:
+        return parseReports(lines(), args.reports)
+    finally:
+        process.kill()
+        process.wait()
+
+
+def metrics(report):
+    total = sum(report["tasks"].values()) or 1
+    return {
+        "instructionsPerControlIteration":
+            report["controlCycles"] / max(report["iterations"], 1),
+        "startupToFirstPwmInstructions": report["firstPwm"],
+        "taskShare": {name: 100.0 * cycles / total
+                      for name, cycles in sorted(report["tasks"].items())},
+    }
+
+
+def compare(current, baseline, tolerance):
+    """
+    @return names of the metrics more than tolerance percent above baseline
+    """
+    regressions = []
+
+    for name in ("instructionsPerControlIteration",
+                 "startupToFirstPwmInstructions"):
+        was = baseline[name]
+        now = current[name]
+        change = 100.0 * (now - was) / was if was else 0.0
+        print("%-34s %12.1f -> %12.1f  %+6.2f%%" % (name, was, now, change))
+        if change > tolerance:
+            regressions.append(name)
+    for task, now in current["taskShare"].items():
+        was = baseline["taskShare"].get(task, 0.0)
+        print("  %-32s %11.2f%% -> %11.2f%%" % (task, was, now))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", nargs="?", default="Debug/stmBreak.elf")
+    parser.add_argument("--qemu", default="qemu-system-arm")
+    parser.add_argument("--log", help="parse a saved run, do not start QEMU")
+    parser.add_argument("--reports", type=int, default=1,
+                        help="reports to wait for, the last one is used")
+    parser.add_argument("--save", help="write the metrics as JSON")
+    parser.add_argument("--baseline", help="compare with saved metrics")
+    parser.add_argument("--tolerance", type=float, default=1.0,
+                        help="percent a metric may grow over the baseline")
+    parser.add_argument("--verbose", action="store_true",
+                        help="echo the firmware output")
+    args = parser.parse_args()
+
+    if args.log:
+        with open(args.log) as log:
+            report = parseReports(log, args.reports)
+    else:
+        report = runQemu(args)
+    if report is None:
+        print("no runtime stats report, built with CONFIG_USE_QEMU, "
+              "CONFIG_USE_SCRIPTED_ADC and CONFIG_USE_RUNTIME_STATS?")
+        return 2
+
+    current = metrics(report)
+    if args.save:
+        with open(args.save, "w") as save:
+            json.dump(current, save, indent=2, sort_keys=True)
+    if args.baseline:
+        with open(args.baseline) as baseline:
+            regressions = compare(current, json.load(baseline), args.tolerance)
+        if regressions:
+            print("regression: " + ", ".join(regressions))
+            return 1
+        return 0
+
+    print(json.dumps(current, indent=2, sort_keys=True))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""Tick accuracy run of the tickless idle under QEMU.
+
+Boots the stmBreak ELF like perf.py does, -icount shift=0 makes one ns of
+virtual time per instruction. Build the image with
+
+    CONFIG_USE_QEMU          1   TIM5 counts virtual ns
+    CONFIG_USE_SCRIPTED_ADC  1   needed by CONFIG_USE_QEMU
+    CONFIG_USE_TICKLESS_IDLE 1
+    CONFIG_USE_TICK_TEST     1   runTickTest() from curveTask
+
+runTickTest() sleeps known periods and prints the RTOS ticks, the HAL ticks,
+the virtual time and the SysTick and TIM7 interrupts of each. Every period
+has to pass with
+
+    HAL_GetTick() and xTaskGetTickCount() within 1 tick of each other
+    the RTOS ticks within 1 tick of the virtual time
+
+and HAL_GetTick() - xTaskGetTickCount() may not drift over the run. Without
+tickless idle both timers interrupt once per ms, the drop is reported per
+period and over the run.
+
+    ticks.py Debug/stmBreak.elf --save baseline.json
+    ticks.py Debug/stmBreak.elf --baseline baseline.json
+    ticks.py --log run.txt                 parse a saved run instead
+"""
+
+import argparse
+import json
+import re
+import subprocess
+import sys
+
+from perf import qemuCommand
+
+PERIOD = re.compile(r"tick test: (\d+) ms, rtos (\d+), hal (\d+), "
+                    r"virtual (\d+) us, (\d+) tick interrupts")
+DONE = re.compile(r"tick test: done, hal - rtos (-?\d+)")
+
+TICK_US = 1000
+TICK_TIMERS = 2  # SysTick and TIM7
+
+
+def parsePeriods(lines):
+    """
+    @param lines output of the firmware
+    @return periods and the final HAL - RTOS tick offset, None if the test
+            did not finish
+    """
+    periods = []
+
+    for line in lines:
+        match = PERIOD.search(line)
+        if match:
+            periods.append({"ms": int(match.group(1)),
+                            "rtos": int(match.group(2)),
+                            "hal": int(match.group(3)),
+                            "virtualUs": int(match.group(4)),
+                            "interrupts": int(match.group(5))})
+            continue
+        match = DONE.search(line)
+        if match:
+            return periods, int(match.group(1))
+    return None
+
+
+def runQemu(args):
+    process = subprocess.Popen(qemuCommand(args), stdout=subprocess.PIPE,
+                               stderr=subprocess.STDOUT,
+                               universal_newlines=True)
+
+    def lines():
+        for line in process.stdout:
+            if args.verbose:
+                sys.stdout.write(line)
+            yield line
+
+    try:
+        return parsePeriods(lines())
+    finally:
+        process.kill()
+        process.wait()
+
+
+def check(periods, offset):
+    """
+    @return failed checks, empty if the ticks are accurate
+    """
+    failures = []
+
+    print("%8s %8s %8s %12s %10s %8s" % ("ms", "rtos", "hal", "virtual us",
+                                         "ticks irq", "drop"))
+    for period in periods:
+        ticking = TICK_TIMERS * period["rtos"]
+        drop = 100.0 * (1 - period["interrupts"] / ticking) if ticking else 0.0
+        print("%8u %8u %8u %12u %10u %7.1f%%" % (
+            period["ms"], period["rtos"], period["hal"], period["virtualUs"],
+            period["interrupts"], drop))
+        if abs(period["hal"] - period["rtos"]) > 1:
+            failures.append("%u ms: HAL and RTOS ticks differ by %d" % (
+                period["ms"], period["hal"] - period["rtos"]))
+        if abs(period["rtos"] * TICK_US - period["virtualUs"]) > TICK_US:
+            failures.append("%u ms: %u RTOS ticks in %u us of virtual time" % (
+                period["ms"], period["rtos"], period["virtualUs"]))
+    if abs(offset) > 1:
+        failures.append("HAL - RTOS ticks drifted to %d" % offset)
+    return failures
+
+
+def metrics(periods):
+    ticks = sum(period["rtos"] for period in periods)
+    interrupts = sum(period["interrupts"] for period in periods)
+    return {
+        "tickInterruptsPerSecond": 1000.0 * interrupts / ticks if ticks else 0.0,
+        "tickInterruptDrop":
+            100.0 * (1 - interrupts / (TICK_TIMERS * ticks)) if ticks else 0.0,
+    }
+
+
+def compare(current, baseline, tolerance):
+    """
+    @return True if the tick interrupt rate grew more than tolerance percent
+    """
+    was = baseline["tickInterruptsPerSecond"]
+    now = current["tickInterruptsPerSecond"]
+    change = 100.0 * (now - was) / was if was else 0.0
+    print("%-34s %12.1f -> %12.1f  %+6.2f%%" % ("tickInterruptsPerSecond",
+                                                was, now, change))
+    return change > tolerance
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", nargs="?", default="Debug/stmBreak.elf")
+    parser.add_argument("--qemu", default="qemu-system-arm")
+    parser.add_argument("--log", help="parse a saved run, do not start QEMU")
+    parser.add_argument("--save", help="write the metrics as JSON")
+    parser.add_argument("--baseline", help="compare with saved metrics")
+    parser.add_argument("--tolerance", type=float, default=1.0,
+                        help="percent the tick interrupt rate may grow "
+                             "over the baseline")
+    parser.add_argument("--verbose", action="store_true",
+                        help="echo the firmware output")
+    args = parser.parse_args()
+
+    if args.log:
+        with open(args.log) as log:
+            result = parsePeriods(log)
+    else:
+        result = runQemu(args)
+    if result is None:
+        print("no tick test result, built with CONFIG_USE_QEMU, "
+              "CONFIG_USE_SCRIPTED_ADC and CONFIG_USE_TICK_TEST?")
+        return 2
+
+    periods, offset = result
+    failures = check(periods, offset)
+    current = metrics(periods)
+    print("tick interrupts: %.1f/s, %.1f%% fewer than without tickless idle"
+          % (current["tickInterruptsPerSecond"], current["tickInterruptDrop"]))
+    for failure in failures:
+        print("inaccurate: " + failure)
+
+    if args.save:
+        with open(args.save, "w") as save:
+            json.dump(current, save, indent=2, sort_keys=True)
+    if args.baseline:
+        with open(args.baseline) as baseline:
+            if compare(current, json.load(baseline), args.tolerance):
+                print("regression: tickInterruptsPerSecond")
+                return 1
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
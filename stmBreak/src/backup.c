@@ -0,0 +1,132 @@
+#include "backup.h"
+#include "cmsis_device.h"
+#include <string.h>
+
+/*
+ * One record of fast changing state in the 4K backup SRAM, kept over
+ * resets, and over power loss while VBAT is supplied. Two slots are
+ * written in turn, the one with the higher sequence number is current. A
+ * save overwrites the older slot and marks it valid last, a reset in
+ * between leaves the other slot as it was. A save is a few word writes,
+ * flash is for the bulk curve data, see store.c.
+ */
+
+#define BACKUP_MAGIC 0x504B4342 // "BCKP"
+#define BACKUP_SLOTS 2
+
+typedef struct BackupRecord
+{
+  uint32_t magic;    // BACKUP_MAGIC once the record is complete
+  uint32_t sequence; // per save, the highest valid one is current
+  uint32_t size;     // data bytes
+  uint32_t check;    // see backupCheck()
+  uint32_t data[BACKUP_MAX_SIZE / 4];
+} BackupRecord;
+
+static BackupRecord* const records = (BackupRecord*)BKPSRAM_BASE;
+static uint32_t currentSlot = 0;
+static uint32_t nextSequence = 1;
+
+static void BKPSRAM_Init(void);
+
+/* Rotate and XOR over the header and the data words, cheap enough for
+ * every save. Catches torn saves and the random content after power loss */
+static uint32_t backupCheck(const BackupRecord* record)
+{
+  uint32_t check = record->sequence ^ (record->size * 0x9E3779B9);
+
+  for (uint32_t i = 0; ((record->size + 3) / 4) > i; ++i)
+  {
+    check = ((check << 5) | (check >> 27)) ^ record->data[i];
+  }
+  return check;
+}
+
+static uint8_t isValid(const BackupRecord* record)
+{
+  return (record->magic == BACKUP_MAGIC) && (record->size <= BACKUP_MAX_SIZE)
+         && (record->check == backupCheck(record));
+}
+
+/**
+ * Enable the backup SRAM, then find the current record. Once at boot,
+ * before any other call.
+ */
+void setupBackup(void)
+{
+  BKPSRAM_Init();
+
+  currentSlot = BACKUP_SLOTS - 1;
+  nextSequence = 1;
+  for (uint32_t slot = 0; BACKUP_SLOTS > slot; ++slot)
+  {
+    const BackupRecord* record = &records[slot];
+    if (isValid(record) && (record->sequence >= nextSequence))
+    {
+      currentSlot = slot;
+      nextSequence = record->sequence + 1;
+    }
+  }
+}
+
+/**
+ * Copy the current record.
+ * @param data destination
+ * @param size capacity of data in bytes
+ * @return number of bytes copied, 0 if nothing was saved or the backup
+ *         domain lost power
+ */
+uint32_t loadBackup(void* data, const uint32_t size)
+{
+  const BackupRecord* record = &records[currentSlot];
+  uint32_t length;
+
+  if (!isValid(record))
+  {
+    return 0;
+  }
+  length = (record->size > size) ? size : record->size;
+  memcpy(data, record->data, length);
+  return length;
+}
+
+/**
+ * Save a new record over the older slot. Not reentrant, save from one
+ * task only.
+ * @param data source
+ * @param size in bytes, up to BACKUP_MAX_SIZE
+ * @return 1 on success
+ */
+uint8_t saveBackup(const void* data, const uint32_t size)
+{
+  const uint32_t slot = (currentSlot + 1) % BACKUP_SLOTS;
+  BackupRecord* record = &records[slot];
+
+  if (size > BACKUP_MAX_SIZE)
+  {
+    return 0;
+  }
+
+  record->magic = 0;
+  __DMB();
+  record->sequence = nextSequence;
+  record->size = size;
+  memcpy(record->data, data, size);
+  record->check = backupCheck(record);
+  __DMB();
+  record->magic = BACKUP_MAGIC;
+
+  currentSlot = slot;
+  nextSequence++;
+  return 1;
+}
+
+/** Backup SRAM init function, the backup regulator keeps it on VBAT
+*/
+static void BKPSRAM_Init(void)
+{
+  __HAL_RCC_PWR_CLK_ENABLE();
+  HAL_PWR_EnableBkUpAccess();
+  __HAL_RCC_BKPSRAM_CLK_ENABLE();
+  HAL_PWREx_EnableBkUpReg();
+}
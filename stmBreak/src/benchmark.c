@@ -0,0 +1,607 @@
+#include "benchmark.h"
+#include "config.h"
+#include "curve.h"
+#include "filter.h"
+#include "probe.h"
+#include "protocol.h"
+#include "store.h"
+#include "device.h"
+#include "stm32f4xx_it.h"
+#include "cmsis_device.h"
+#include "cmsis_os.h"
+#include "diag/Trace.h"
+#include <string.h>
+
+#if CONFIG_USE_BENCHMARKS
+
+static void benchmarkCurves(void);
+static void benchmarkCurveCodec(void);
+static void benchmarkFilter(void);
+static void benchmarkCrc(void);
+static void benchmarkPool(void);
+static void benchmarkProbes(void);
+
+/**
+ * Run all benchmarks and print the results over trace.
+ * Meant to be called after setupDevice(), which starts the DWT cycle
+ * counter, and before the scheduler, interrupts would otherwise be
+ * counted in.
+ */
+void runBenchmarks(void)
+{
+  benchmarkCurves();
+  benchmarkCurveCodec();
+  benchmarkFilter();
+  benchmarkCrc();
+  benchmarkPool();
+  benchmarkProbes();
+}
+
+static uint32_t cyclesToNs(const uint32_t cycles)
+{
+  return (uint32_t)(((uint64_t)cycles * 1000000000u) / SystemCoreClock);
+}
+
+/**
+ * @param cycles for a sweep of all CURVE_SIZE ADC codes
+ */
+static uint32_t samplesPerSecond(const uint32_t cycles)
+{
+  if (cycles == 0)
+  {
+    return 0;
+  }
+  return (uint32_t)(((uint64_t)CURVE_SIZE * SystemCoreClock) / cycles);
+}
+
+/* A smooth user curve, like the ones uploaded by the host, and its points
+ * decoded back from the code */
+static uint16_t userPoints[CURVE_USER_POINTS];
+static uint8_t userCode[CURVE_CODE_SIZE];
+static uint16_t userDecoded[CURVE_USER_POINTS];
+
+static uint32_t encodeUserPoints(void)
+{
+  for (uint32_t i = 0; CURVE_USER_POINTS > i; ++i)
+  {
+    userPoints[i] = (i * i) / CURVE_USER_POINTS;
+  }
+  return encodeCurve(userCode, CURVE_CODE_SIZE, userPoints, CURVE_USER_POINTS);
+}
+
+/**
+ * Cycles per sample of the float brake function path against the
+ * precomputed duty cycle table, for every brake function, sweeping all
+ * CURVE_SIZE ADC codes. Also as ns/sample and throughput at SystemCoreClock.
+ * The float path of user curves indexes the points decoded once, as the
+ * firmware did before the table.
+ */
+static void benchmarkCurves(void)
+{
+  static uint16_t table[CURVE_SIZE];
+  const uint32_t userSize = encodeUserPoints();
+  volatile uint32_t dutyCycle;
+
+  decodeCurve(userDecoded, CURVE_USER_POINTS, userCode, userSize);
+  uint32_t start;
+  uint32_t floatCycles;
+  uint32_t tableCycles;
+  uint32_t buildCycles;
+
+  for (uint32_t function = 0; BF_NR_ITEMS > function; ++function)
+  {
+    Curve curve = { (BrakeFunction)function, 0, 1000, userCode, userSize,
+                    userDecoded };
+
+    start = DWT->CYCCNT;
+    for (uint32_t adcRaw = 0; CURVE_SIZE > adcRaw; ++adcRaw)
+    {
+      dutyCycle = evaluateCurve(&curve, curveInput(adcRaw, curve.maxValue)) + 0.5f;
+    }
+    floatCycles = DWT->CYCCNT - start;
+
+    start = DWT->CYCCNT;
+    buildCurveTable(table, &curve);
+    buildCycles = DWT->CYCCNT - start;
+
+    start = DWT->CYCCNT;
+    for (uint32_t adcRaw = 0; CURVE_SIZE > adcRaw; ++adcRaw)
+    {
+      dutyCycle = table[adcRaw];
+    }
+    tableCycles = DWT->CYCCNT - start;
+
+    trace_printf("curve %u: float %u, table %u cycles/sample, build %u cycles\n",
+                 function, floatCycles / CURVE_SIZE, tableCycles / CURVE_SIZE,
+                 buildCycles);
+    trace_printf("curve %u: float %u ns/sample %u ksamples/s, table %u ns/sample %u ksamples/s\n",
+                 function,
+                 cyclesToNs(floatCycles) / CURVE_SIZE,
+                 samplesPerSecond(floatCycles) / 1000,
+                 cyclesToNs(tableCycles) / CURVE_SIZE,
+                 samplesPerSecond(tableCycles) / 1000);
+  }
+  (void)dutyCycle;
+}
+
+/**
+ * Size and cycles of the user curve code: encoding on commit, decoding
+ * all points, and building a table straight from the code on a switch.
+ */
+static void benchmarkCurveCodec(void)
+{
+  static uint16_t points[CURVE_USER_POINTS];
+  static uint16_t table[CURVE_SIZE];
+  uint32_t start;
+  uint32_t encodeCycles;
+  uint32_t decodeCycles;
+  uint32_t buildCycles;
+  uint32_t size;
+  uint32_t decoded;
+
+  encodeUserPoints();
+
+  start = DWT->CYCCNT;
+  size = encodeCurve(userCode, CURVE_CODE_SIZE, userPoints, CURVE_USER_POINTS);
+  encodeCycles = DWT->CYCCNT - start;
+
+  start = DWT->CYCCNT;
+  decoded = decodeCurve(points, CURVE_USER_POINTS, userCode, size);
+  decodeCycles = DWT->CYCCNT - start;
+
+  Curve curve = { BF_USER1, 0, 1000, userCode, size, NULL };
+  start = DWT->CYCCNT;
+  buildCurveTable(table, &curve);
+  buildCycles = DWT->CYCCNT - start;
+
+  trace_printf("user curve: %u bytes raw, %u coded, %u points decoded\n",
+               sizeof(userPoints), size, decoded);
+  trace_printf("user curve: encode %u, decode %u (%u/point), build %u cycles\n",
+               encodeCycles, decodeCycles, decodeCycles / CURVE_USER_POINTS,
+               buildCycles);
+}
+
+/**
+ * Cycles per block and per input sample of every filter preset, against
+ * the per sample budget at a 20 kHz input rate.
+ */
+static void benchmarkFilter(void)
+{
+  static const uint32_t blockSizes[] = { 8, 16, 32, 64 };
+  static uint16_t samples[64] __attribute__((aligned(4)));
+  const uint32_t budget = SystemCoreClock / 20000;
+  volatile uint32_t value;
+  Filter filter;
+  uint32_t start;
+  uint32_t cycles;
+
+  for (uint32_t i = 0; 64 > i; ++i)
+  {
+    samples[i] = (i * 1237) & 0xFFF;
+  }
+
+  trace_printf("filter budget at 20 kHz: %u cycles/sample\n", budget);
+  for (uint32_t preset = 0; FILTER_NR_ITEMS > preset; ++preset)
+  {
+    initFilter(&filter, &filterPresets[preset], 0);
+    for (uint32_t i = 0; (sizeof(blockSizes) / sizeof(blockSizes[0])) > i; ++i)
+    {
+      start = DWT->CYCCNT;
+      value = filterBlock(&filter, samples, blockSizes[i]);
+      cycles = DWT->CYCCNT - start;
+
+      trace_printf("filter %u, block %u: %u cycles, %u cycles/sample\n",
+                   preset, blockSizes[i], cycles, cycles / blockSizes[i]);
+    }
+  }
+  (void)value;
+}
+
+/**
+ * CRC-32 of 1 KB of flash on the CRC unit against the software CRC, and
+ * the time of a store mount, which checks the CRC of every record.
+ */
+static void benchmarkCrc(void)
+{
+  const uint8_t* data = (const uint8_t*)FLASH_BASE;
+  volatile uint32_t crc;
+  uint32_t start;
+  uint32_t hardwareCycles;
+  uint32_t softwareCycles;
+  uint32_t checkCycles;
+  uint32_t records = 0;
+  uint32_t bytes = 0;
+
+  start = DWT->CYCCNT;
+  crc = computeCrc(data, 1024, CRC32_INIT);
+  hardwareCycles = DWT->CYCCNT - start;
+
+  start = DWT->CYCCNT;
+  crc = crc32(data, 1024, CRC32_INIT);
+  softwareCycles = DWT->CYCCNT - start;
+
+  /* The CRC pass of mountStore() over the current version of every id,
+   * mapStore() makes the same check without touching the index */
+  start = DWT->CYCCNT;
+  for (uint32_t id = 0; STORE_MAX_IDS > id; ++id)
+  {
+    uint32_t size;
+    if (mapStore(id, &size))
+    {
+      records++;
+      bytes += size;
+    }
+  }
+  checkCycles = DWT->CYCCNT - start;
+
+  trace_printf("crc32 1 KB: unit %u us, software %u us\n",
+               cyclesToNs(hardwareCycles) / 1000, cyclesToNs(softwareCycles) / 1000);
+  trace_printf("store mount CRC pass: %u records, %u bytes, %u us\n", records, bytes,
+               cyclesToNs(checkCycles) / 1000);
+  (void)crc;
+}
+
+/* The marker scan osPoolAlloc() had before the free list, to compare
+ * against. originalPoolAlloc() is the loop as it was, its index wrap goes
+ * to 0 every time after the end, so it misses free blocks before the
+ * current index. markerPoolAlloc() wraps correctly. */
+typedef struct MarkerPool
+{
+  void* pool;
+  uint8_t* markers;
+  uint32_t pool_sz;
+  uint32_t item_sz;
+  uint32_t currentIndex;
+} MarkerPool;
+
+static void* originalPoolAlloc(MarkerPool* pool_id)
+{
+  int dummy = 0;
+  void* p = NULL;
+  uint32_t i;
+  uint32_t index;
+
+  if (__get_IPSR() != 0)
+  {
+    dummy = portSET_INTERRUPT_MASK_FROM_ISR();
+  }
+  else
+  {
+    vPortEnterCritical();
+  }
+
+  for (i = 0; i < pool_id->pool_sz; i++)
+  {
+    index = pool_id->currentIndex + i;
+    if (index >= pool_id->pool_sz)
+    {
+      index = 0;
+    }
+
+    if (pool_id->markers[index] == 0)
+    {
+      pool_id->markers[index] = 1;
+      p = (void*)((uint32_t)(pool_id->pool) + (index * pool_id->item_sz));
+      pool_id->currentIndex = index;
+      break;
+    }
+  }
+
+  if (__get_IPSR() != 0)
+  {
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(dummy);
+  }
+  else
+  {
+    vPortExitCritical();
+  }
+
+  return p;
+}
+
+static void* markerPoolAlloc(MarkerPool* pool_id)
+{
+  int dummy = 0;
+  void* p = NULL;
+  uint32_t i;
+  uint32_t index;
+
+  if (__get_IPSR() != 0)
+  {
+    dummy = portSET_INTERRUPT_MASK_FROM_ISR();
+  }
+  else
+  {
+    vPortEnterCritical();
+  }
+
+  for (i = 0; i < pool_id->pool_sz; i++)
+  {
+    index = pool_id->currentIndex + i;
+    if (index >= pool_id->pool_sz)
+    {
+      index -= pool_id->pool_sz;
+    }
+
+    if (pool_id->markers[index] == 0)
+    {
+      pool_id->markers[index] = 1;
+      p = (void*)((uint32_t)(pool_id->pool) + (index * pool_id->item_sz));
+      pool_id->currentIndex = index;
+      break;
+    }
+  }
+
+  if (__get_IPSR() != 0)
+  {
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(dummy);
+  }
+  else
+  {
+    vPortExitCritical();
+  }
+
+  return p;
+}
+
+static void markerPoolFree(MarkerPool* pool_id, void* block)
+{
+  const uint32_t index = ((uint32_t)block - (uint32_t)pool_id->pool) / pool_id->item_sz;
+
+  if (pool_id->pool_sz > index)
+  {
+    pool_id->markers[index] = 0;
+  }
+}
+
+static uint32_t poolItems[1024];
+static uint8_t poolMarkers[1024];
+static void* poolBlocks[1024];
+static os_pool_cb_t poolControl;
+
+/* Cycles of one run over a pool, per block for fill and drain */
+typedef struct PoolCycles
+{
+  uint32_t fill;
+  uint32_t last;
+  uint32_t full;
+  uint32_t drain;
+  uint8_t lastFound;
+} PoolCycles;
+
+/**
+ * One run of the marker scan, from a cleared pool.
+ */
+static PoolCycles runMarkerPool(void* (*alloc)(MarkerPool*), const uint32_t size)
+{
+  MarkerPool pool = { poolItems, poolMarkers, size, sizeof(uint32_t), 0 };
+  PoolCycles cycles;
+  void* block;
+  uint32_t start;
+
+  memset(poolItems, 0, sizeof(poolItems));
+  memset(poolMarkers, 0, sizeof(poolMarkers));
+
+  start = DWT->CYCCNT;
+  for (uint32_t j = 0; size > j; ++j)
+  {
+    poolBlocks[j] = alloc(&pool);
+  }
+  cycles.fill = (DWT->CYCCNT - start) / size;
+  markerPoolFree(&pool, poolBlocks[size - 2]);
+  start = DWT->CYCCNT;
+  block = alloc(&pool);
+  cycles.last = DWT->CYCCNT - start;
+  cycles.lastFound = block != NULL;
+  start = DWT->CYCCNT;
+  block = alloc(&pool);
+  cycles.full = DWT->CYCCNT - start;
+  start = DWT->CYCCNT;
+  for (uint32_t j = 0; size > j; ++j)
+  {
+    markerPoolFree(&pool, poolBlocks[j]);
+  }
+  cycles.drain = (DWT->CYCCNT - start) / size;
+  (void)block;
+  return cycles;
+}
+
+static void printPoolCycles(const char* name, const uint32_t size,
+                            const PoolCycles* cycles)
+{
+  trace_printf("pool %u %s: fill %u, drain %u cycles/block, last %u%s, full %u cycles\n",
+               size, name, cycles->fill, cycles->drain, cycles->last,
+               cycles->lastFound ? "" : " (missed the free block)", cycles->full);
+}
+
+/**
+ * Cycles per alloc and free of the free list against the marker scan as
+ * it was and with its wrap corrected, at pool sizes 8 to 1024. fill and
+ * drain allocate and free every block in order, last allocates the one
+ * block left, which the scan finds at the far end, and full allocates
+ * from an empty pool. Every run starts from a cleared pool.
+ */
+static void benchmarkPool(void)
+{
+  static const uint32_t poolSizes[] = { 8, 64, 256, 1024 };
+  osPoolInfo_t info;
+  PoolCycles cycles;
+  void* block;
+  uint32_t start;
+
+  for (uint32_t i = 0; (sizeof(poolSizes) / sizeof(poolSizes[0])) > i; ++i)
+  {
+    const uint32_t size = poolSizes[i];
+    const osPoolDef_t poolDef = { size, sizeof(uint32_t), poolItems, &poolControl };
+
+    memset(poolItems, 0, sizeof(poolItems));
+    memset(&poolControl, 0, sizeof(poolControl));
+    memset(&info, 0, sizeof(info));
+    const osPoolId pool = osPoolCreate(&poolDef);
+
+    start = DWT->CYCCNT;
+    for (uint32_t j = 0; size > j; ++j)
+    {
+      poolBlocks[j] = osPoolAlloc(pool);
+    }
+    cycles.fill = (DWT->CYCCNT - start) / size;
+    osPoolFree(pool, poolBlocks[size - 2]);
+    start = DWT->CYCCNT;
+    block = osPoolAlloc(pool);
+    cycles.last = DWT->CYCCNT - start;
+    cycles.lastFound = block != NULL;
+    start = DWT->CYCCNT;
+    block = osPoolAlloc(pool);
+    cycles.full = DWT->CYCCNT - start;
+    start = DWT->CYCCNT;
+    for (uint32_t j = 0; size > j; ++j)
+    {
+      osPoolFree(pool, poolBlocks[j]);
+    }
+    cycles.drain = (DWT->CYCCNT - start) / size;
+    osPoolGetInfo(pool, &info);
+    printPoolCycles("free list", size, &cycles);
+
+    cycles = runMarkerPool(originalPoolAlloc, size);
+    printPoolCycles("markers as they were", size, &cycles);
+    cycles = runMarkerPool(markerPoolAlloc, size);
+    printPoolCycles("markers, wrap corrected", size, &cycles);
+
+    trace_printf("pool %u counters: high water %u, failures %u\n",
+                 size, info.high_water, info.failures);
+  }
+  (void)block;
+}
+
+/**
+ * Cycles added by one PROBE_BEGIN/PROBE_END pair around an empty block.
+ */
+static void benchmarkProbes(void)
+{
+#if CONFIG_USE_PROBES
+  const uint32_t runs = 1000;
+  uint32_t start;
+  uint32_t cycles;
+  ProbeStats stats;
+
+  resetProbes();
+  start = DWT->CYCCNT;
+  for (uint32_t i = 0; runs > i; ++i)
+  {
+    PROBE_BEGIN(PROBE_CONTROL_LOOP);
+    __NOP();
+    PROBE_END(PROBE_CONTROL_LOOP);
+  }
+  cycles = DWT->CYCCNT - start;
+
+  start = DWT->CYCCNT;
+  for (uint32_t i = 0; runs > i; ++i)
+  {
+    __NOP();
+  }
+  cycles -= DWT->CYCCNT - start;
+
+  readProbe(PROBE_CONTROL_LOOP, &stats);
+  trace_printf("probe: %u cycles/probe, measured %u..%u cycles\n",
+               cycles / runs, stats.min, stats.max);
+  if ((cycles / runs) > PROBE_BUDGET_CYCLES)
+  {
+    trace_printf("probe: over the budget of %u cycles\n", PROBE_BUDGET_CYCLES);
+  }
+  resetProbes();
+#endif
+}
+
+#else
+
+void runBenchmarks(void)
+{
+}
+
+#endif /* CONFIG_USE_BENCHMARKS */
+
+#if CONFIG_USE_TICK_TEST
+
+#if !CONFIG_USE_QEMU || !CONFIG_USE_TICKLESS_IDLE
+#error "CONFIG_USE_TICK_TEST needs CONFIG_USE_QEMU and CONFIG_USE_TICKLESS_IDLE"
+#endif
+
+/* Sleeps of the tick test, in ms. The longest stays below the 4.29 s TIM5
+ * wraps after. */
+static const uint32_t tickTestPeriods[] = { 1, 2, 5, 10, 50, 100, 500, 2000 };
+
+/**
+ * Sleep each of tickTestPeriods and print over trace what the RTOS tick,
+ * the HAL tick and TIM5 saw meanwhile, one line per period. TIM5 counts
+ * virtual ns under QEMU, see QEMU_Init(). Without tickless idle SysTick and
+ * TIM7 would each interrupt once per ms, qemu/ticks.py checks the ticks
+ * against each other and the virtual time and reports the drop.
+ */
+void runTickTest(void)
+{
+  for (uint32_t i = 0; (sizeof(tickTestPeriods) / sizeof(tickTestPeriods[0])) > i; ++i)
+  {
+    /* Start on a tick edge */
+    osDelay(1);
+
+    const uint32_t rtos = xTaskGetTickCount();
+    const uint32_t hal = HAL_GetTick();
+    const uint32_t interrupts = sysTickCount + halTickCount;
+    const uint32_t start = getCycleCount();
+
+    osDelay(tickTestPeriods[i]);
+
+    const uint32_t time = getCycleCount() - start;
+    trace_printf("tick test: %u ms, rtos %u, hal %u, virtual %u us, "
+                 "%u tick interrupts\n",
+                 tickTestPeriods[i], xTaskGetTickCount() - rtos,
+                 HAL_GetTick() - hal, time / 1000,
+                 sysTickCount + halTickCount - interrupts);
+  }
+  trace_printf("tick test: done, hal - rtos %i\n",
+               (int32_t)(HAL_GetTick() - xTaskGetTickCount()));
+}
+
+#else
+
+void runTickTest(void)
+{
+}
+
+#endif /* CONFIG_USE_TICK_TEST */
+
+#if CONFIG_USE_RUNTIME_STATS
+
+/**
+ * Print the control loop counters and the CPU time of every task over
+ * trace. With CONFIG_USE_SCRIPTED_ADC runs see the same input, so reports
+ * of two firmware builds compare directly.
+ * @param controlIterations control loop runs since start
+ * @param controlCycles cycles spent in those runs
+ * @param firstPwmCycles cycles from setupDevice() to the first control loop
+ */
+void reportRuntimeStats(const uint32_t controlIterations,
+                        const uint32_t controlCycles,
+                        const uint32_t firstPwmCycles)
+{
+  static char taskStats[48 * 8];
+
+  trace_printf("control: %u iterations, %u cycles, first PWM after %u cycles\n",
+               controlIterations, controlCycles, firstPwmCycles);
+#if CONFIG_USE_TICKLESS_IDLE
+  trace_printf("idle: %u ticks asleep without tick interrupts\n",
+               getSuppressedTicks());
+#endif
+  vTaskGetRunTimeStats(taskStats);
+  trace_printf("task\t\tcycles\t\tshare\n%s", taskStats);
+}
+
+#else
+
+void reportRuntimeStats(const uint32_t controlIterations,
+                        const uint32_t controlCycles,
+                        const uint32_t firstPwmCycles)
+{
+}
+
+#endif /* CONFIG_USE_RUNTIME_STATS */
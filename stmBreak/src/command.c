@@ -0,0 +1,206 @@
+#include "command.h"
+#include "curve.h"
+#include "serial.h"
+#include "probe.h"
+#include "config.h"
+#include "cmsis_os.h"
+#include <string.h>
+
+static const CommandTarget* target;
+
+/* Curve upload, FRAME_CURVE_DATA fills it and FRAME_COMMIT_CURVE saves it */
+static uint16_t uploadData[CURVE_USER_POINTS];
+static BrakeFunction uploadFunction = BF_NR_ITEMS;
+
+/* uploadData encoded, FRAME_COMMIT_CURVE saves this. Aligned and in SRAM,
+ * the store CRC reads it by DMA */
+static uint8_t uploadCode[CURVE_CODE_SIZE] __attribute__((aligned(4)));
+
+/* Answer to the FRAME_COMMIT_CURVE being written, uploadCode is read by the
+ * flash task until curveCommitted() */
+static ResponsePayload commitResponse;
+static volatile uint8_t commitPending = 0;
+
+/**
+ * @param commandTarget kept, must outlive commandTask
+ */
+void setupCommands(const CommandTarget* commandTarget)
+{
+  target = commandTarget;
+}
+
+static uint8_t isUserFunction(const uint32_t function)
+{
+  return (function < BF_NR_ITEMS) && (target->userBank[function] != NULL);
+}
+
+/**
+ * Result of a FRAME_COMMIT_CURVE, called from the flash task.
+ */
+static void curveCommitted(const FlashBank* bank, uint8_t written, void* context)
+{
+  ResponsePayload* response = (ResponsePayload*)context;
+
+  if (written)
+  {
+    target->curveChanged(uploadFunction);
+  }
+  response->status = written ? CMD_OK : CMD_FAILED;
+  sendFrame(FRAME_RESPONSE, response, sizeof(*response));
+  commitPending = 0;
+}
+
+/**
+ * @param frame received command frame
+ * @return result reported to the host
+ */
+CommandStatus executeCommand(const Frame* frame)
+{
+  switch (frame->type)
+  {
+    case FRAME_CURVE_DATA:
+    {
+      const CurveDataPayload* payload = (const CurveDataPayload*)frame->payload;
+      if ((frame->size < sizeof(CurveDataPayload))
+          || !isUserFunction(payload->function))
+      {
+        return CMD_INVALID;
+      }
+
+      const uint32_t count = (frame->size - sizeof(CurveDataPayload)) / sizeof(uint16_t);
+      if ((payload->offset + count) > CURVE_USER_POINTS)
+      {
+        return CMD_INVALID;
+      }
+      if (commitPending)
+      {
+        return CMD_BUSY;
+      }
+
+      /* Switching curves starts over from the saved one */
+      if (uploadFunction != payload->function)
+      {
+        const uint32_t size = readFromFlashBank(uploadCode, CURVE_CODE_SIZE,
+                                                target->userBank[payload->function]);
+        if (decodeCurve(uploadData, CURVE_USER_POINTS, uploadCode, size)
+            != CURVE_USER_POINTS)
+        {
+          memset(uploadData, 0, sizeof(uploadData));
+        }
+        uploadFunction = (BrakeFunction)payload->function;
+      }
+
+      for (uint32_t i = 0; count > i; ++i)
+      {
+        uploadData[payload->offset + i] = payload->points[i];
+      }
+      return CMD_OK;
+    }
+    case FRAME_SELECT_FUNCTION:
+    {
+      const SelectFunctionPayload* payload = (const SelectFunctionPayload*)frame->payload;
+      if ((frame->size != sizeof(SelectFunctionPayload))
+          || (payload->function >= BF_NR_ITEMS))
+      {
+        return CMD_INVALID;
+      }
+
+      target->selectFunction((BrakeFunction)payload->function);
+      return CMD_OK;
+    }
+    case FRAME_COMMIT_CURVE:
+    {
+      const CommitCurvePayload* payload = (const CommitCurvePayload*)frame->payload;
+      if ((frame->size != sizeof(CommitCurvePayload))
+          || (payload->function != uploadFunction))
+      {
+        return CMD_INVALID;
+      }
+
+      if (commitPending)
+      {
+        return CMD_BUSY;
+      }
+
+      const uint32_t size = encodeCurve(uploadCode, CURVE_CODE_SIZE, uploadData,
+                                        CURVE_USER_POINTS);
+      if (size == 0)
+      {
+        return CMD_FAILED;
+      }
+
+      /* Written in the background, the control loop keeps running */
+      commitResponse.sequence = frame->sequence;
+      commitResponse.type = frame->type;
+      commitPending = 1;
+      if (!commitToFlashBank(uploadCode, size, target->userBank[payload->function],
+                             curveCommitted, &commitResponse))
+      {
+        commitPending = 0;
+        return CMD_FAILED;
+      }
+      return CMD_PENDING;
+    }
+    case FRAME_SELECT_FILTER:
+    {
+      const SelectFilterPayload* payload = (const SelectFilterPayload*)frame->payload;
+      if ((frame->size != sizeof(SelectFilterPayload))
+          || (payload->preset >= FILTER_NR_ITEMS))
+      {
+        return CMD_INVALID;
+      }
+
+      setFilterCoefficients(target->leverFilter, &filterPresets[payload->preset]);
+      return CMD_OK;
+    }
+#if CONFIG_USE_PROBES
+    case FRAME_READ_PROBES:
+    {
+      const ReadProbesPayload* payload = (const ReadProbesPayload*)frame->payload;
+      if (frame->size != sizeof(ReadProbesPayload))
+      {
+        return CMD_INVALID;
+      }
+
+      ProbeReport report;
+      for (uint32_t id = 0; PROBE_NR_ITEMS > id; ++id)
+      {
+        report.id = id;
+        readProbe((ProbeId)id, &report.stats);
+        sendFrame(FRAME_PROBE, &report, sizeof(report));
+      }
+      if (payload->reset)
+      {
+        resetProbes();
+      }
+      return CMD_OK;
+    }
+#endif
+    default:
+      return CMD_UNKNOWN;
+  }
+}
+
+/**
+ * Executes command frames received over USART1 and answers each with a
+ * FRAME_RESPONSE frame, a commit is answered by curveCommitted().
+ */
+void commandTask(void const* argument)
+{
+  Frame frame;
+
+  while (1)
+  {
+    if (receiveFrame(&frame, osWaitForever))
+    {
+      ResponsePayload response;
+      response.sequence = frame.sequence;
+      response.type = frame.type;
+      response.status = executeCommand(&frame);
+      if (response.status != CMD_PENDING)
+      {
+        sendFrame(FRAME_RESPONSE, &response, sizeof(response));
+      }
+    }
+  }
+}
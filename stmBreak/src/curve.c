@@ -0,0 +1,345 @@
+#include "curve.h"
+#include <math.h>
+#include <stddef.h>
+
+static float functionOff(const float x, const Curve* curve)
+{
+  return 0;
+}
+
+static float functionOn(const float x, const Curve* curve)
+{
+  return curve->maxValue;
+}
+
+static float functionLinear(const float x, const Curve* curve)
+{
+  return x;
+}
+
+static float functionToggle(const float x, const Curve* curve)
+{
+  return (((int) (x + 0.5)) % 2) ? curve->minValue : curve->maxValue;
+}
+
+static float functionExp(const float x, const Curve* curve, const uint8_t p)
+{
+  //return curve->maxValue - (((powf(curve->maxValue - x, p)) / powf(curve->maxValue, p)) * curve->maxValue);
+  return curve->maxValue - powf(curve->maxValue - x, p);
+}
+
+static float functionExp2(const float x, const Curve* curve)
+{
+  return functionExp(x, curve, 2);
+}
+
+static float functionExp3(const float x, const Curve* curve)
+{
+  return functionExp(x, curve, 2);
+}
+
+static float functionExp4(const float x, const Curve* curve)
+{
+  return functionExp(x, curve, 2);
+}
+
+/**
+ * @param x function input
+ * @return user curve point at x, 0..CURVE_USER_POINTS-1
+ */
+static int32_t userIndex(const float x)
+{
+  int32_t index = (int32_t)(x + 0.5f);
+
+  if (index < 0)
+  {
+    index = 0;
+  }
+  else if (index >= CURVE_USER_POINTS)
+  {
+    index = CURVE_USER_POINTS - 1;
+  }
+  return index;
+}
+
+/* A direct index into the decoded points, a curve without them evaluates
+ * as zeros. buildCurveTable() decodes the code itself, in one pass */
+static float functionUser(const float x, const Curve* curve)
+{
+  return curve->userPoints ? curve->userPoints[userIndex(x)] : 0;
+}
+
+static float (*const brakeFunctions[BF_NR_ITEMS+1])(float, const Curve*) =
+{
+  [BF_OFF] =    functionOff,
+  [BF_ON] =     functionOn,
+
+  [BF_LINEAR] = functionLinear,
+
+  [BF_EXP2] =   functionExp2,
+  [BF_EXP3] =   functionExp3,
+  [BF_EXP4] =   functionExp4,
+
+  [BF_TOGGLE] = functionToggle,
+
+  [BF_USER1] =  functionUser,
+  [BF_USER2] =  functionUser,
+  [BF_USER3] =  functionUser,
+
+  [BF_NR_ITEMS] = functionOff
+};
+
+/**
+ * Map a raw 12-bit ADC code to the input of the brake functions.
+ * @param adcRaw ADC code, 0..CURVE_SIZE-1
+ * @param maxValue brake maximum
+ * @return function input x
+ */
+float curveInput(const uint32_t adcRaw, const uint32_t maxValue)
+{
+  return maxValue - ((((adcRaw + 1) / 4096.0f) * maxValue) * 2);
+}
+
+/**
+ * Evaluate the brake function of a curve.
+ * @param curve brake function and its parameters
+ * @param x function input, see curveInput()
+ * @return unclamped function output
+ */
+float evaluateCurve(const Curve* curve, const float x)
+{
+  BrakeFunction function = curve->function;
+
+  if (function > BF_NR_ITEMS)
+  {
+    function = BF_NR_ITEMS;
+  }
+  return (*brakeFunctions[function])(x, curve);
+}
+
+/**
+ * Expand a user curve into the table in one pass. The function input rises
+ * as the ADC code falls, so going from the top code down needs the points
+ * in the order they are coded. A damaged code leaves the rest at 0.
+ */
+static void buildUserTable(uint16_t* table, const Curve* curve)
+{
+  CurveDecoder decoder;
+  int32_t index = -1;
+  uint16_t point = 0;
+
+  initCurveDecoder(&decoder, curve->userData, curve->userSize);
+  for (int32_t adcRaw = CURVE_SIZE - 1; adcRaw >= 0; --adcRaw)
+  {
+    const int32_t wanted = userIndex(curveInput(adcRaw, curve->maxValue));
+
+    while (index < wanted)
+    {
+      if (!nextCurvePoint(&decoder, &point))
+      {
+        point = 0;
+        index = CURVE_USER_POINTS;
+        break;
+      }
+      index++;
+    }
+    table[adcRaw] = (point > curve->maxValue) ? curve->maxValue : point;
+  }
+}
+
+/**
+ * Precompute the duty cycle of every ADC code.
+ * The per-sample path then is a single load, table[adcRaw].
+ * @param table CURVE_SIZE items
+ * @param curve brake function and its parameters
+ */
+void buildCurveTable(uint16_t* table, const Curve* curve)
+{
+  if ((curve->function >= BF_USER1) && (curve->function <= BF_USER3))
+  {
+    buildUserTable(table, curve);
+    return;
+  }
+
+  for (uint32_t adcRaw = 0; CURVE_SIZE > adcRaw; ++adcRaw)
+  {
+    float y = evaluateCurve(curve, curveInput(adcRaw, curve->maxValue)) + 0.5f;
+
+    if (!(y >= 0)) // also catches NaN
+    {
+      y = 0;
+    }
+    else if (y > curve->maxValue)
+    {
+      y = curve->maxValue;
+    }
+    table[adcRaw] = (uint16_t)y;
+  }
+}
+
+/*
+ * User curve code: the point count as varint, then per point the zigzag
+ * varint of its second difference, point - 2 * previous + the one before.
+ * Smooth curves give mostly zeros and small values of one byte, a run of
+ * n zeros is coded as 0, varint n - 1. Varints are 7 bits per byte, least
+ * significant first, the top bit set on all but the last byte.
+ */
+
+static uint8_t* putVarint(uint8_t* out, const uint8_t* end, uint32_t value)
+{
+  do
+  {
+    if ((out == NULL) || (out == end))
+    {
+      return NULL;
+    }
+    *out++ = (value & 0x7F) | ((value > 0x7F) ? 0x80 : 0);
+    value >>= 7;
+  } while (value);
+  return out;
+}
+
+static uint8_t getVarint(CurveDecoder* decoder, uint32_t* value)
+{
+  uint32_t result = 0;
+
+  for (uint32_t shift = 0; 32 > shift; shift += 7)
+  {
+    if (decoder->data == decoder->end)
+    {
+      return 0;
+    }
+    const uint8_t byte = *decoder->data++;
+    result |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+    {
+      *value = result;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Encode points for storage, see nextCurvePoint() for the way back.
+ * @param data destination
+ * @param capacity of data in bytes, CURVE_CODE_SIZE always fits
+ * @param points source
+ * @param count number of points
+ * @return code size in bytes, 0 if it does not fit
+ */
+uint32_t encodeCurve(uint8_t* data, const uint32_t capacity,
+                     const uint16_t* points, const uint32_t count)
+{
+  const uint8_t* end = data + capacity;
+  uint8_t* out = putVarint(data, end, count);
+  int32_t value = 0;
+  int32_t delta = 0;
+  uint32_t zeros = 0;
+
+  for (uint32_t i = 0; count > i; ++i)
+  {
+    const int32_t nextDelta = (int32_t)points[i] - value;
+    const int32_t change = nextDelta - delta;
+
+    value = points[i];
+    delta = nextDelta;
+    if (change == 0)
+    {
+      zeros++;
+      continue;
+    }
+    if (zeros > 0)
+    {
+      out = putVarint(putVarint(out, end, 0), end, zeros - 1);
+      zeros = 0;
+    }
+    out = putVarint(out, end, ((uint32_t)change << 1) ^ (uint32_t)(change >> 31));
+  }
+  if (zeros > 0)
+  {
+    out = putVarint(putVarint(out, end, 0), end, zeros - 1);
+  }
+
+  return (out != NULL) ? (uint32_t)(out - data) : 0;
+}
+
+/**
+ * @param decoder set to the first point
+ * @param data code, see encodeCurve(), NULL decodes no points
+ * @param size of data in bytes
+ */
+void initCurveDecoder(CurveDecoder* decoder, const uint8_t* data,
+                      const uint32_t size)
+{
+  decoder->data = data;
+  decoder->end = data + size;
+  decoder->run = 0;
+  decoder->value = 0;
+  decoder->delta = 0;
+  if ((data == NULL) || !getVarint(decoder, &decoder->remaining))
+  {
+    decoder->remaining = 0;
+  }
+}
+
+/**
+ * Decode the next point, constant time per point.
+ * @param decoder position, see initCurveDecoder()
+ * @param point set to the point
+ * @return 0 past the last point or if the code is damaged
+ */
+uint8_t nextCurvePoint(CurveDecoder* decoder, uint16_t* point)
+{
+  uint32_t code = 0;
+
+  if (decoder->remaining == 0)
+  {
+    return 0;
+  }
+
+  if (decoder->run > 0)
+  {
+    decoder->run--;
+  }
+  else if (!getVarint(decoder, &code)
+           || ((code == 0) && !getVarint(decoder, &decoder->run)))
+  {
+    decoder->remaining = 0;
+    return 0;
+  }
+
+  decoder->delta += (int32_t)(code >> 1) ^ -(int32_t)(code & 1);
+  decoder->value += decoder->delta;
+  if ((decoder->value < 0) || (decoder->value > 0xFFFF))
+  {
+    decoder->remaining = 0;
+    return 0;
+  }
+
+  decoder->remaining--;
+  *point = (uint16_t)decoder->value;
+  return 1;
+}
+
+/**
+ * Decode all points of a code.
+ * @param points destination
+ * @param count capacity of points
+ * @param data code, see encodeCurve()
+ * @param size of data in bytes
+ * @return number of points decoded
+ */
+uint32_t decodeCurve(uint16_t* points, const uint32_t count,
+                     const uint8_t* data, const uint32_t size)
+{
+  CurveDecoder decoder;
+  uint32_t decoded = 0;
+
+  initCurveDecoder(&decoder, data, size);
+  while ((count > decoded) && nextCurvePoint(&decoder, &points[decoded]))
+  {
+    decoded++;
+  }
+  return decoded;
+}
@@ -1,35 +1,678 @@
 #include "device.h"
+#include "config.h"
+#include "protocol.h"
 #include "cmsis_device.h"
 #include "diag/Trace.h"
 #include <stdlib.h>
+#include <string.h>
 
 ADC_HandleTypeDef hadc1;
+DMA_HandleTypeDef hdma_adc1;
 TIM_HandleTypeDef htim1;
+TIM_HandleTypeDef htim2;
 UART_HandleTypeDef huart1;
+DMA_HandleTypeDef hdma_usart1_tx;
+DMA_HandleTypeDef hdma_usart1_rx;
+
+#define ADC_BUFFER_SIZE (2 * CONFIG_ADC_BLOCK_SIZE)
+#define FLASH_SR_ERRORS (FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR)
+
+/* Circular DMA target of ADC1, each half is handed out as one block */
+static uint16_t adcBuffer[ADC_BUFFER_SIZE] __attribute__((aligned(4)));
+static AdcBlockHandler adcBlockHandler = NULL;
+static UartTxHandler uartTxHandler = NULL;
+
+static const uint32_t FLASH_SECTORS[12] =
+{
+  ((uint32_t)0x08000000), /* Base @ of Sector 0, 16 Kbytes */// used by program
+  ((uint32_t)0x08004000), /* Base @ of Sector 1, 16 Kbytes */// used by program
+  ((uint32_t)0x08008000), /* Base @ of Sector 2, 16 Kbytes */// used by program
+  ((uint32_t)0x0800C000), /* Base @ of Sector 3, 16 Kbytes */// used by program
+  ((uint32_t)0x08010000), /* Base @ of Sector 4, 64 Kbytes */
+  ((uint32_t)0x08020000), /* Base @ of Sector 5, 128 Kbytes */
+  ((uint32_t)0x08040000), /* Base @ of Sector 6, 128 Kbytes */
+  ((uint32_t)0x08060000), /* Base @ of Sector 7, 128 Kbytes */
+  ((uint32_t)0x08080000), /* Base @ of Sector 8, 128 Kbytes */
+  ((uint32_t)0x080A0000), /* Base @ of Sector 9, 128 Kbytes */
+  ((uint32_t)0x080C0000), /* Base @ of Sector 10, 128 Kbytes */
+  ((uint32_t)0x080E0000), /* Base @ of Sector 11, 128 Kbytes */
+};
+
+/* Circular DMA target of USART1, read behind the DMA by uartReceive() */
+static uint8_t uartRxBuffer[CONFIG_UART_RX_BUFFER_SIZE];
+static uint32_t uartRxTail = 0;
+static UartRxHandler uartRxHandler = NULL;
+
+typedef enum FlashOperation
+{
+  FLASH_OP_NONE = 0,
+  FLASH_OP_ERASE,
+  FLASH_OP_PROGRAM
+} FlashOperation;
+
+/* Erase or program in progress, advanced by the flash interrupt */
+static volatile FlashOperation flashOperation = FLASH_OP_NONE;
+static uint32_t flashAddress;       // next address, or next sector to erase
+static uint32_t flashEnd;           // address, or sector, after the last one
+static const uint8_t* flashSource;
+static volatile uint32_t flashError = 0;
+static FlashWaitHandler flashWaitHandler = NULL;
+static FlashDoneHandler flashDoneHandler = NULL;
+
+/* CRC unit feed, memory to memory is DMA2 only, stream 1 is free */
+#define CRC_DMA_STREAM    DMA2_Stream1
+#define CRC_DMA_FLAGS     (DMA_LISR_TCIF1 | DMA_LISR_HTIF1 | DMA_LISR_TEIF1 \
+                           | DMA_LISR_DMEIF1 | DMA_LISR_FEIF1)
+#define CRC_DMA_MIN_WORDS 16     // below, the CPU feeds faster than the setup
+#define CRC_DMA_MAX_WORDS 0xFFFF // NDTR
+
+#if CONFIG_CONTROL_IN_RAM
+/* Core exceptions and all interrupts, VTOR needs the next power of two as
+ * alignment */
+#define VECTOR_COUNT (16 + FPU_IRQn + 1)
+static uint32_t ramVectors[VECTOR_COUNT] __attribute__((aligned(512)));
+#endif
 
 static void Device_Error_Handler(void);
 
 static void SystemClock_Config(void);
 static void GPIO_Init(void);
+static void DWT_Init(void);
+static void DMA_Init(void);
 static void TIM1_Init(void);
+static void TIM2_Init(void);
 static void ADC1_Init(void);
 static void USART1_UART_Init(void);
-static void FLASH_Init(void);
+static void FLASH_IF_Init(void);
+static void CRC_Init(void);
+#if CONFIG_CONTROL_IN_RAM
+static void VECTOR_Init(void);
+#endif
+#if CONFIG_USE_QEMU
+static void QEMU_Init(void);
+#endif
+static void startUartReceive(void);
+static uint8_t runFlash(FlashOperation operation, uint32_t first, uint32_t end,
+                        const uint8_t* source);
+static void startFlashStep(void);
+static void continueFlash(void);
+static uint8_t feedCrc(const uint32_t* words, uint32_t count);
+
+void CONTROL_FUNC setPwm(uint32_t dutyCycle)
+{
+    TIM1->CCR2 = dutyCycle;
+}
+
+/**
+ * Let the TIM1 update interrupt run the control loop. Call once the curve,
+ * the telemetry ring and the tasks it signals exist, just before the
+ * scheduler starts.
+ */
+void startControlLoop(void)
+{
+#if CONFIG_USE_QEMU
+  TIM3->SR = ~TIM_SR_UIF;
+  HAL_NVIC_ClearPendingIRQ(TIM3_IRQn);
+  HAL_NVIC_EnableIRQ(TIM3_IRQn);
+#else
+  __HAL_TIM_CLEAR_FLAG(&htim1, TIM_FLAG_UPDATE);
+  HAL_NVIC_ClearPendingIRQ(TIM1_UP_TIM10_IRQn);
+  HAL_NVIC_EnableIRQ(TIM1_UP_TIM10_IRQn);
+#endif
+}
+
+#if CONFIG_USE_SCRIPTED_ADC
 
-void setPwm(uint32_t dutyCycle)
+/* Write position of scriptedAdcSample(), stands in for the DMA counter */
+static uint32_t scriptedAdcNext = 0;
+static uint32_t scriptedAdcValue = 0;
+static int32_t scriptedAdcStep = CONFIG_SCRIPTED_ADC_STEP;
+
+uint32_t getAdc(void)
 {
-    __HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_2, dutyCycle);
-    //TIM1->CCR2 = dutyCycle;
+  return adcBuffer[(scriptedAdcNext + ADC_BUFFER_SIZE - 1) % ADC_BUFFER_SIZE];
 }
 
+/**
+ * Scripted stand-in for one ADC1 conversion and its DMA transfer, called
+ * from the TIM2 update interrupt at the sample rate. Sweeps all ADC codes
+ * up and down, so every run sees the same input without a lever attached.
+ */
+void scriptedAdcSample(void)
+{
+  adcBuffer[scriptedAdcNext] = scriptedAdcValue;
+
+  scriptedAdcValue += scriptedAdcStep;
+  if (scriptedAdcValue > 4095)
+  {
+    scriptedAdcStep = -scriptedAdcStep;
+    scriptedAdcValue = (scriptedAdcStep < 0) ? 4095 : 0;
+  }
+
+  scriptedAdcNext++;
+  if (scriptedAdcNext == CONFIG_ADC_BLOCK_SIZE)
+  {
+    HAL_ADC_ConvHalfCpltCallback(&hadc1);
+  }
+  else if (scriptedAdcNext == ADC_BUFFER_SIZE)
+  {
+    scriptedAdcNext = 0;
+    HAL_ADC_ConvCpltCallback(&hadc1);
+  }
+}
+
+#else
+
 uint32_t getAdc(void)
 {
-    return HAL_ADC_GetValue(&hadc1);
+  /* The latest conversion sits just before the DMA write position */
+  uint32_t next = ADC_BUFFER_SIZE - __HAL_DMA_GET_COUNTER(&hdma_adc1);
+  return adcBuffer[(next + ADC_BUFFER_SIZE - 1) % ADC_BUFFER_SIZE];
+}
+
+#endif /* CONFIG_USE_SCRIPTED_ADC */
+
+/**
+ * Set the TIM2 trigger rate of ADC1.
+ * @param rateHz requested rate, clamped to the configured limits
+ * @return rate actually reached with the integer timer period
+ */
+uint32_t setAdcSampleRate(uint32_t rateHz)
+{
+  uint32_t timClock = HAL_RCC_GetPCLK1Freq();
+  uint32_t period = 0;
+
+  /* APB1 timers run at twice PCLK1 when the bus is divided */
+  if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_HCLK_DIV1)
+  {
+    timClock *= 2;
+  }
+
+  if (rateHz < CONFIG_ADC_SAMPLE_RATE_MIN_HZ)
+  {
+    rateHz = CONFIG_ADC_SAMPLE_RATE_MIN_HZ;
+  }
+  else if (rateHz > CONFIG_ADC_SAMPLE_RATE_MAX_HZ)
+  {
+    rateHz = CONFIG_ADC_SAMPLE_RATE_MAX_HZ;
+  }
+
+  period = (timClock / rateHz) - 1;
+  __HAL_TIM_SET_AUTORELOAD(&htim2, period);
+
+  return timClock / (period + 1);
+}
+
+void setAdcBlockHandler(AdcBlockHandler handler)
+{
+  adcBlockHandler = handler;
+}
+
+#if CONFIG_CONTROL_IN_RAM
+/**
+ * ADC1 DMA interrupt without the HAL, so it runs from RAM as a whole. Hands
+ * out the finished half of adcBuffer like the HAL callbacks below.
+ */
+void CONTROL_FUNC adcDmaInterrupt(void)
+{
+  const uint32_t flags = DMA2->LISR & (DMA_LISR_TCIF0 | DMA_LISR_HTIF0 | DMA_LISR_TEIF0
+                                       | DMA_LISR_DMEIF0 | DMA_LISR_FEIF0);
+
+  DMA2->LIFCR = flags;
+  if (adcBlockHandler && (flags & DMA_LISR_HTIF0))
+  {
+    adcBlockHandler(&adcBuffer[0], CONFIG_ADC_BLOCK_SIZE);
+  }
+  if (adcBlockHandler && (flags & DMA_LISR_TCIF0))
+  {
+    adcBlockHandler(&adcBuffer[CONFIG_ADC_BLOCK_SIZE], CONFIG_ADC_BLOCK_SIZE);
+  }
+}
+#endif
+
+/**
+ * DMA half transfer, the first half of adcBuffer is complete.
+ */
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef* hadc)
+{
+  if (hadc->Instance == ADC1 && adcBlockHandler)
+  {
+    adcBlockHandler(&adcBuffer[0], CONFIG_ADC_BLOCK_SIZE);
+  }
+}
+
+/**
+ * DMA transfer complete, the second half of adcBuffer is complete.
+ */
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* hadc)
+{
+  if (hadc->Instance == ADC1 && adcBlockHandler)
+  {
+    adcBlockHandler(&adcBuffer[CONFIG_ADC_BLOCK_SIZE], CONFIG_ADC_BLOCK_SIZE);
+  }
+}
+
+/**
+ * Start a USART1 DMA transmission, does not wait for it.
+ * @param data must stay valid until the UartTxHandler is called
+ * @param size number of bytes
+ * @return 1 if started, 0 if a transmission is still in progress
+ */
+uint8_t uartSend(const void* data, uint16_t size)
+{
+  return HAL_UART_Transmit_DMA(&huart1, (uint8_t*)data, size) == HAL_OK;
+}
+
+void setUartTxHandler(UartTxHandler handler)
+{
+  uartTxHandler = handler;
+}
+
+/**
+ * Last byte of a uartSend() transmission left the shift register.
+ */
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart)
+{
+  if (huart->Instance == USART1 && uartTxHandler)
+  {
+    uartTxHandler();
+  }
+}
+
+/**
+ * Copy the bytes received since the last call out of the USART1 ring.
+ * Only one task may read. The ring holds CONFIG_UART_RX_BUFFER_SIZE bytes,
+ * older unread bytes are overwritten.
+ * @param data destination
+ * @param size capacity of data
+ * @return number of bytes copied
+ */
+uint32_t uartReceive(void* data, uint32_t size)
+{
+  const uint32_t head = (CONFIG_UART_RX_BUFFER_SIZE
+                         - __HAL_DMA_GET_COUNTER(&hdma_usart1_rx))
+                        % CONFIG_UART_RX_BUFFER_SIZE;
+  uint8_t* bytes = (uint8_t*)data;
+  uint32_t count = 0;
+
+  while ((uartRxTail != head) && (size > count))
+  {
+    bytes[count++] = uartRxBuffer[uartRxTail];
+    uartRxTail = (uartRxTail + 1) % CONFIG_UART_RX_BUFFER_SIZE;
+  }
+  return count;
+}
+
+void setUartRxHandler(UartRxHandler handler)
+{
+  uartRxHandler = handler;
+}
+
+/**
+ * USART1 line went idle after a received byte, called from interrupt.
+ * Together with the ring half and full callbacks this hands a burst to the
+ * reader as soon as it ended, without waiting for a ring half to fill.
+ */
+void uartRxIdle(void)
+{
+  if (uartRxHandler)
+  {
+    uartRxHandler();
+  }
+}
+
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef* huart)
+{
+  if (huart->Instance == USART1)
+  {
+    uartRxIdle();
+  }
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef* huart)
+{
+  if (huart->Instance == USART1)
+  {
+    uartRxIdle();
+  }
+}
+
+/**
+ * Framing, noise or overrun error, HAL stops the receive DMA on these.
+ * Restart the ring, the broken frame fails its CRC.
+ */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef* huart)
+{
+  if ((huart->Instance == USART1) && (huart->RxState == HAL_UART_STATE_READY))
+  {
+    startUartReceive();
+    uartRxIdle();
+  }
+}
+
+/**
+ * @param address inside the flash
+ * @return sector number, FLASH_SECTOR_0..FLASH_SECTOR_11
+ */
+uint32_t getFlashSector(uint32_t address)
+{
+  uint32_t sector = FLASH_SECTOR_11;
+
+  while ((sector > FLASH_SECTOR_0) && (address < FLASH_SECTORS[sector]))
+  {
+    sector--;
+  }
+  return sector;
+}
+
+uint32_t getFlashSectorAddress(uint32_t sector)
+{
+  return FLASH_SECTORS[sector];
+}
+
+/**
+ * @param sector FLASH_SECTOR_0..FLASH_SECTOR_11
+ * @return size in bytes
+ */
+uint32_t getFlashSectorSize(uint32_t sector)
+{
+  if (sector <= FLASH_SECTOR_3)
+  {
+    return 16 * 1024;
+  }
+  else if (sector == FLASH_SECTOR_4)
+  {
+    return 64 * 1024;
+  }
+  return 128 * 1024;
+}
+
+/**
+ * Erase flash sectors, blocks the caller until done. The sectors are erased
+ * one after the other from the flash interrupt, see waitFlash().
+ * @param firstSector FLASH_SECTOR_0..FLASH_SECTOR_11
+ * @param count number of sectors
+ * @return 1 on success, 0 on error, see getFlashError()
+ */
+uint8_t eraseFlash(uint32_t firstSector, uint32_t count)
+{
+  return runFlash(FLASH_OP_ERASE, firstSector, firstSector + count, NULL);
+}
+
+/**
+ * Program erased flash, blocks the caller until done. Whole words are
+ * programmed with 32-bit parallelism whatever the item size, only the
+ * unaligned head and tail go byte by byte. Each word is started from the
+ * end of operation interrupt of the one before, see waitFlash().
+ * @param address destination
+ * @param data source, any alignment, must not be in the flash
+ * @param size in items
+ * @param itemSize 1, 2, 4 or 8 bytes
+ * @return 1 on success, 0 on error, see getFlashError()
+ */
+uint8_t programFlash(uint32_t address, const void* data, uint32_t size,
+                     uint32_t itemSize)
+{
+  if ((itemSize != 1) && (itemSize != 2) && (itemSize != 4) && (itemSize != 8))
+  {
+    return 0;
+  }
+
+  return runFlash(FLASH_OP_PROGRAM, address, address + (size * itemSize),
+                  (const uint8_t*)data);
+}
+
+/**
+ * Wait for flash operations by a task, instead of spinning on BSY.
+ * @param handler blocks until the FlashDoneHandler was called, NULL to poll
+ */
+void setFlashWaitHandler(FlashWaitHandler handler)
+{
+  flashWaitHandler = handler;
 }
 
-void uartSend(void* data, uint16_t size)
+/**
+ * @param handler called from the flash interrupt once an erase or program
+ * finished or failed
+ */
+void setFlashDoneHandler(FlashDoneHandler handler)
 {
-  HAL_UART_Transmit(&huart1, (uint8_t*)data, size, 10000);
+  flashDoneHandler = handler;
+}
+
+/**
+ * End of operation or error of the flash interface, called from
+ * FLASH_IRQHandler.
+ */
+void flashEndOfOperation(void)
+{
+  if (flashOperation != FLASH_OP_NONE)
+  {
+    continueFlash();
+  }
+}
+
+/**
+ * Start an erase or program and wait for it. With a FlashWaitHandler the
+ * steps are chained from the flash interrupt and the caller sleeps, without
+ * one (before the scheduler runs) the same steps are polled.
+ * @param operation FLASH_OP_ERASE or FLASH_OP_PROGRAM
+ * @param first first sector or address
+ * @param end sector or address after the last one
+ * @param source program data
+ * @return 1 on success
+ */
+static uint8_t runFlash(FlashOperation operation, uint32_t first, uint32_t end,
+                        const uint8_t* source)
+{
+  if ((flashOperation != FLASH_OP_NONE) || (first == end)
+      || (HAL_FLASH_Unlock() != HAL_OK))
+  {
+    return first == end;
+  }
+
+  while (FLASH->SR & FLASH_SR_BSY)
+  {
+  }
+  FLASH->SR = FLASH_SR_EOP | FLASH_SR_SOP | FLASH_SR_ERRORS;
+
+  flashAddress = first;
+  flashEnd = end;
+  flashSource = source;
+  flashError = 0;
+
+  if (flashWaitHandler)
+  {
+    flashOperation = operation;
+    startFlashStep();
+    while (flashOperation != FLASH_OP_NONE)
+    {
+      flashWaitHandler();
+    }
+  }
+  else
+  {
+    HAL_NVIC_DisableIRQ(FLASH_IRQn);
+    flashOperation = operation;
+    startFlashStep();
+    while (flashOperation != FLASH_OP_NONE)
+    {
+      while (FLASH->SR & FLASH_SR_BSY)
+      {
+      }
+      continueFlash();
+    }
+    HAL_NVIC_ClearPendingIRQ(FLASH_IRQn);
+    HAL_NVIC_EnableIRQ(FLASH_IRQn);
+  }
+
+  return flashError == 0;
+}
+
+/**
+ * Start the next sector erase or the next word (or head and tail byte) of
+ * a program. EOP, or OPERR on an error, follows once the flash is done.
+ */
+static void startFlashStep(void)
+{
+  const uint32_t control = (FLASH->CR & ~(FLASH_CR_PSIZE | FLASH_CR_SNB | FLASH_CR_SER | FLASH_CR_PG))
+                           | FLASH_IT_EOP | FLASH_IT_ERR;
+
+  if (flashOperation == FLASH_OP_ERASE)
+  {
+    FLASH->CR = control | FLASH_PSIZE_WORD | FLASH_CR_SER
+                | (flashAddress << FLASH_CR_SNB_Pos);
+    FLASH->CR |= FLASH_CR_STRT;
+    flashAddress++;
+  }
+  else if ((flashAddress & 3) || ((flashEnd - flashAddress) < 4))
+  {
+    FLASH->CR = control | FLASH_PSIZE_BYTE | FLASH_CR_PG;
+    *(volatile uint8_t*)flashAddress = *flashSource;
+    flashAddress++;
+    flashSource++;
+  }
+  else
+  {
+    uint32_t word;
+    memcpy(&word, flashSource, sizeof(word));
+    FLASH->CR = control | FLASH_PSIZE_WORD | FLASH_CR_PG;
+    *(volatile uint32_t*)flashAddress = word;
+    flashAddress += 4;
+    flashSource += 4;
+  }
+  __DSB();
+}
+
+/**
+ * A step completed, start the next one or finish the operation.
+ */
+static void continueFlash(void)
+{
+  const uint32_t status = FLASH->SR;
+
+  FLASH->SR = FLASH_SR_EOP | FLASH_SR_SOP | FLASH_SR_ERRORS;
+  if (status & FLASH_SR_ERRORS)
+  {
+    flashError = status & FLASH_SR_ERRORS;
+  }
+  else if (flashAddress != flashEnd)
+  {
+    startFlashStep();
+    return;
+  }
+
+  FLASH->CR &= ~(FLASH_CR_PSIZE | FLASH_CR_SNB | FLASH_CR_SER | FLASH_CR_PG
+                 | FLASH_IT_EOP | FLASH_IT_ERR);
+  FLASH_FlushCaches();
+  FLASH->CR |= FLASH_CR_LOCK;
+
+  flashOperation = FLASH_OP_NONE;
+  if (flashDoneHandler)
+  {
+    flashDoneHandler();
+  }
+}
+
+/**
+ * @return FLASH->SR error flags of the last failed erase or program
+ */
+uint32_t getFlashError(void)
+{
+  return flashError;
+}
+
+/**
+ * CRC-32 on the CRC unit, the same checksum as crc32(). Long runs of
+ * aligned words are fed by DMA, the rest by the CPU. Data touching CCM,
+ * which DMA cannot read, is fed by the CPU. Unaligned data and a running
+ * value the unit no longer holds go to crc32(). Not reentrant, callers share the unit under the
+ * store lock.
+ * @param data bytes to add
+ * @param size number of bytes
+ * @param crc running value, CRC32_INIT for a new checksum
+ * @return updated checksum
+ */
+uint32_t computeCrc(const void* data, const uint32_t size, const uint32_t crc)
+{
+  const uint32_t address = (uint32_t)data;
+  const uint32_t* words = (const uint32_t*)data;
+  uint32_t count = size / 4;
+
+  if (crc == CRC32_INIT)
+  {
+    CRC->CR = CRC_CR_RESET;
+  }
+  if ((address & 3) || (CRC->DR != crc))
+  {
+    return crc32((const uint8_t*)data, size, crc);
+  }
+
+  if ((count >= CRC_DMA_MIN_WORDS)
+      && (((address + size) <= CCMDATARAM_BASE) || (address > CCMDATARAM_END)))
+  {
+    while (count > 0)
+    {
+      const uint32_t run = (count > CRC_DMA_MAX_WORDS) ? CRC_DMA_MAX_WORDS : count;
+      if (!feedCrc(words, run))
+      {
+        return crc32((const uint8_t*)data, size, crc);
+      }
+      words += run;
+      count -= run;
+    }
+  }
+
+  while (count > 0)
+  {
+    CRC->DR = *words++;
+    count--;
+  }
+  if (size & 3)
+  {
+    uint32_t last = 0;
+    memcpy(&last, words, size & 3);
+    CRC->DR = last;
+  }
+  return CRC->DR;
+}
+
+/**
+ * Feed words to the CRC unit by DMA2 memory to memory, waits until done.
+ * @return 0 on a transfer error, the CRC unit then holds garbage
+ */
+static uint8_t feedCrc(const uint32_t* words, uint32_t count)
+{
+  CRC_DMA_STREAM->CR = 0;
+  while (CRC_DMA_STREAM->CR & DMA_SxCR_EN)
+  {}
+  DMA2->LIFCR = CRC_DMA_FLAGS;
+
+  /* Memory to memory reads from the peripheral port */
+  CRC_DMA_STREAM->PAR = (uint32_t)words;
+  CRC_DMA_STREAM->M0AR = (uint32_t)&CRC->DR;
+  CRC_DMA_STREAM->NDTR = count;
+  CRC_DMA_STREAM->FCR = DMA_SxFCR_DMDIS | DMA_SxFCR_FTH;
+  CRC_DMA_STREAM->CR = DMA_SxCR_DIR_1 | DMA_SxCR_PINC | DMA_SxCR_PSIZE_1
+                       | DMA_SxCR_MSIZE_1 | DMA_SxCR_EN;
+
+  while (!(DMA2->LISR & (DMA_LISR_TCIF1 | DMA_LISR_TEIF1)))
+  {}
+  const uint8_t done = !(DMA2->LISR & DMA_LISR_TEIF1);
+  DMA2->LIFCR = CRC_DMA_FLAGS;
+  return done;
+}
+
+/**
+ * @return core cycles, or instructions under QEMU, see QEMU_Init()
+ */
+uint32_t CONTROL_FUNC getCycleCount(void)
+{
+#if CONFIG_USE_QEMU
+  return TIM5->CNT;
+#else
+  return DWT->CYCCNT;
+#endif
 }
 
 uint8_t isButtonOnBoardPressed(void)
@@ -49,6 +692,10 @@ void ledOnBoardOff(void)
 
 void setupDevice(void)
 {
+#if CONFIG_CONTROL_IN_RAM
+  VECTOR_Init();
+#endif
+
   /* Reset of all peripherals, Initializes the Flash interface and the Systick. */
   HAL_Init();
 
@@ -56,10 +703,18 @@ void setupDevice(void)
   SystemClock_Config();
 
   /* Initialize all configured peripherals */
+  DWT_Init();
   GPIO_Init();
+  DMA_Init();
   TIM1_Init();
+  TIM2_Init();
+#if CONFIG_USE_QEMU
+  QEMU_Init();
+#endif
   ADC1_Init();
   USART1_UART_Init();
+  FLASH_IF_Init();
+  CRC_Init();
 }
 
 /** System Clock Configuration
@@ -114,14 +769,14 @@ static void ADC1_Init(void)
   hadc1.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV2;
   hadc1.Init.Resolution = ADC_RESOLUTION_12B;
   hadc1.Init.ScanConvMode = DISABLE;
-  hadc1.Init.ContinuousConvMode = ENABLE;
+  hadc1.Init.ContinuousConvMode = DISABLE;
   hadc1.Init.DiscontinuousConvMode = DISABLE;
-  hadc1.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
-  hadc1.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+  hadc1.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING;
+  hadc1.Init.ExternalTrigConv = ADC_EXTERNALTRIGCONV_T2_TRGO;
   hadc1.Init.DataAlign = ADC_DATAALIGN_RIGHT;
   hadc1.Init.NbrOfConversion = 1;
-  hadc1.Init.DMAContinuousRequests = DISABLE;
-  hadc1.Init.EOCSelection = ADC_EOC_SEQ_CONV;
+  hadc1.Init.DMAContinuousRequests = ENABLE;
+  hadc1.Init.EOCSelection = ADC_EOC_SINGLE_CONV;
 
   if (HAL_ADC_Init(&hadc1) != HAL_OK)
   {
@@ -137,7 +792,149 @@ static void ADC1_Init(void)
     Device_Error_Handler();
   }
 
-  HAL_ADC_Start(&hadc1);
+#if CONFIG_USE_SCRIPTED_ADC
+  /* TIM2 paces scriptedAdcSample() instead of the conversions */
+  HAL_NVIC_SetPriority(TIM2_IRQn, CONFIG_ADC_DMA_IRQ_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(TIM2_IRQn);
+  HAL_TIM_Base_Start_IT(&htim2);
+#else
+  /* Arm the DMA ring before the first trigger edge arrives */
+  if (HAL_ADC_Start_DMA(&hadc1, (uint32_t*)adcBuffer, ADC_BUFFER_SIZE) != HAL_OK)
+  {
+    Device_Error_Handler();
+  }
+
+  HAL_TIM_Base_Start(&htim2);
+#endif
+}
+
+/** TIM2 init function, trigger source of ADC1
+*/
+static void TIM2_Init(void)
+{
+  TIM_ClockConfigTypeDef sClockSourceConfig;
+  TIM_MasterConfigTypeDef sMasterConfig;
+
+  htim2.Instance = TIM2;
+  htim2.Init.Prescaler = 0;
+  htim2.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim2.Init.Period = 0xFFFF;
+  htim2.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  if (HAL_TIM_Base_Init(&htim2) != HAL_OK)
+  {
+    Device_Error_Handler();
+  }
+
+  sClockSourceConfig.ClockSource = TIM_CLOCKSOURCE_INTERNAL;
+  if (HAL_TIM_ConfigClockSource(&htim2, &sClockSourceConfig) != HAL_OK)
+  {
+    Device_Error_Handler();
+  }
+
+  /* Every update event starts one conversion */
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_UPDATE;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim2, &sMasterConfig) != HAL_OK)
+  {
+    Device_Error_Handler();
+  }
+
+  /* ARR is preloaded after the first rate, a new one takes effect on the
+   * next update event. Written directly the 32 bit counter could already
+   * be past it and run to 2^32 without a trigger. */
+  setAdcSampleRate(CONFIG_ADC_SAMPLE_RATE_HZ);
+  htim2.Instance->CR1 |= TIM_CR1_ARPE;
+}
+
+#if CONFIG_CONTROL_IN_RAM
+/** Vector table init function, moves the table to RAM so entering the
+ * control interrupts does not fetch from the flash
+*/
+static void VECTOR_Init(void)
+{
+  extern const uint32_t __vectors_start[];
+
+  memcpy(ramVectors, __vectors_start, sizeof(ramVectors));
+  __DSB();
+  SCB->VTOR = (uint32_t)ramVectors;
+  __DSB();
+}
+#endif
+
+#if CONFIG_USE_QEMU
+#if !CONFIG_USE_SCRIPTED_ADC
+#error "CONFIG_USE_QEMU needs CONFIG_USE_SCRIPTED_ADC, the machine has no ADC DMA"
+#endif
+/** QEMU init function. The netduinoplus2 machine models neither TIM1 nor
+ * the DWT, TIM3 runs the control loop at the TIM1 rate and TIM5 counts
+ * instead of CYCCNT. The machine clocks TIM2-5 at 1 GHz of virtual time,
+ * which with -icount shift=0 is one count per instruction.
+*/
+static void QEMU_Init(void)
+{
+  __HAL_RCC_TIM3_CLK_ENABLE();
+  __HAL_RCC_TIM5_CLK_ENABLE();
+
+  TIM5->PSC = 0;
+  TIM5->ARR = 0xFFFFFFFF;
+  TIM5->CR1 = TIM_CR1_CEN;
+
+  TIM3->PSC = htim1.Init.Prescaler;
+  TIM3->ARR = htim1.Init.Period;
+  TIM3->DIER = TIM_DIER_UIE;
+  TIM3->CR1 = TIM_CR1_CEN;
+  HAL_NVIC_SetPriority(TIM3_IRQn, CONFIG_CONTROL_IRQ_PRIORITY, 0);
+}
+#endif
+
+/** DWT init function, free running core cycle counter for timestamps
+*/
+static void DWT_Init(void)
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#if CONFIG_USE_TICKLESS_IDLE && defined(DEBUG)
+  /* Keep the debugger attached while the idle task sleeps. This keeps the
+   * core clock running in sleep, release builds leave it off. */
+  DBGMCU->CR |= DBGMCU_CR_DBG_SLEEP;
+#endif
+}
+
+/** Flash interface init function, erase and program finish in its interrupt
+*/
+static void FLASH_IF_Init(void)
+{
+  HAL_NVIC_SetPriority(FLASH_IRQn, CONFIG_FLASH_IRQ_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(FLASH_IRQn);
+}
+
+/** CRC unit init function, see computeCrc(), its DMA2 stream is polled
+*/
+static void CRC_Init(void)
+{
+  __HAL_RCC_CRC_CLK_ENABLE();
+  CRC->CR = CRC_CR_RESET;
+}
+
+/** DMA init function
+*/
+static void DMA_Init(void)
+{
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA2_CLK_ENABLE();
+
+  /* DMA2_Stream0_IRQn interrupt configuration, ADC1 */
+  HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, CONFIG_ADC_DMA_IRQ_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+
+  /* DMA2_Stream2_IRQn interrupt configuration, USART1 RX */
+  HAL_NVIC_SetPriority(DMA2_Stream2_IRQn, CONFIG_UART_IRQ_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream2_IRQn);
+
+  /* DMA2_Stream7_IRQn interrupt configuration, USART1 TX */
+  HAL_NVIC_SetPriority(DMA2_Stream7_IRQn, CONFIG_UART_IRQ_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream7_IRQn);
 }
 
 /** TIM1 init function
@@ -189,6 +986,16 @@ static void TIM1_Init(void)
     Device_Error_Handler();
   }
 
+  /* CCR2 and ARR are preloaded, a new duty cycle takes effect on the next
+   * update event and never in the middle of a PWM period */
+  htim1.Instance->CCMR1 |= TIM_CCMR1_OC2PE;
+  htim1.Instance->CR1 |= TIM_CR1_ARPE;
+
+  /* The update event runs the control loop, see controlLoop(). The
+   * interrupt stays off until startControlLoop() */
+  HAL_NVIC_SetPriority(TIM1_UP_TIM10_IRQn, CONFIG_CONTROL_IRQ_PRIORITY, 0);
+  __HAL_TIM_ENABLE_IT(&htim1, TIM_IT_UPDATE);
+
   HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_2);
 }
 
@@ -198,7 +1005,7 @@ static void USART1_UART_Init(void)
 {
 
   huart1.Instance = USART1;
-  huart1.Init.BaudRate = 115200;
+  huart1.Init.BaudRate = CONFIG_UART_BAUD_RATE;
   huart1.Init.WordLength = UART_WORDLENGTH_9B;
   huart1.Init.StopBits = UART_STOPBITS_2;
   huart1.Init.Parity = UART_PARITY_ODD;
@@ -210,6 +1017,17 @@ static void USART1_UART_Init(void)
     Device_Error_Handler();
   }
 
+  startUartReceive();
+  __HAL_UART_ENABLE_IT(&huart1, UART_IT_IDLE);
+}
+
+static void startUartReceive(void)
+{
+  uartRxTail = 0;
+  if (HAL_UART_Receive_DMA(&huart1, uartRxBuffer, CONFIG_UART_RX_BUFFER_SIZE) != HAL_OK)
+  {
+    Device_Error_Handler();
+  }
 }
 
 /** GPIO init function
@@ -223,9 +1041,9 @@ static void GPIO_Init(void)
     __HAL_RCC_GPIOB_CLK_ENABLE();
     __HAL_RCC_GPIOA_CLK_ENABLE();
 
-    /*Configure GPIO pin : PA0 */
+    /*Configure GPIO pin : PA0, both edges for the input service */
     GPIO_InitStruct.Pin = GPIO_PIN_0;
-    GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+    GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
     GPIO_InitStruct.Pull = GPIO_PULLDOWN;
     HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 
@@ -240,24 +1058,26 @@ static void GPIO_Init(void)
     HAL_GPIO_WritePin(GPIOC, GPIO_PIN_12, GPIO_PIN_RESET);
 
 
-    /*Configure GPIO pins : PC3 PC5 */
+    /*Configure GPIO pins : PC3 PC5, both edges for the input service */
     GPIO_InitStruct.Pin = GPIO_PIN_3|GPIO_PIN_5;
-    GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
+    GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
     GPIO_InitStruct.Pull = GPIO_PULLDOWN;
     HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
 
-    /*Configure GPIO pins : PA2 PA4 */
+    /*Configure GPIO pins : PA2 PA4, both edges for the input service */
     GPIO_InitStruct.Pin = GPIO_PIN_2|GPIO_PIN_4;
-    GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
+    GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
     GPIO_InitStruct.Pull = GPIO_PULLDOWN;
     HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 
     /*Configure the EXTI IRQ priority */
+    HAL_NVIC_SetPriority(EXTI0_IRQn, TICK_INT_PRIORITY + 1, 0);
     HAL_NVIC_SetPriority(EXTI2_IRQn, TICK_INT_PRIORITY + 1, 0);
     HAL_NVIC_SetPriority(EXTI3_IRQn, TICK_INT_PRIORITY + 1, 0);
     HAL_NVIC_SetPriority(EXTI4_IRQn, TICK_INT_PRIORITY + 1, 0);
     HAL_NVIC_SetPriority(EXTI9_5_IRQn, TICK_INT_PRIORITY + 1, 0);
     /* Enable the EXTI global Interrupt */
+    HAL_NVIC_EnableIRQ(EXTI0_IRQn);
     HAL_NVIC_EnableIRQ(EXTI2_IRQn);
     HAL_NVIC_EnableIRQ(EXTI3_IRQn);
     HAL_NVIC_EnableIRQ(EXTI4_IRQn);
@@ -0,0 +1,159 @@
+#include "filter.h"
+#include <string.h>
+
+#if defined(__ARM_FEATURE_DSP)
+#include "cmsis_device.h"
+#else
+/* Plain C equivalents of the Cortex-M4 DSP instructions used below */
+static inline uint32_t __SMLAD(uint32_t op1, uint32_t op2, uint32_t op3)
+{
+  return op3 + ((int16_t)op1 * (int16_t)op2)
+             + ((int16_t)(op1 >> 16) * (int16_t)(op2 >> 16));
+}
+
+static inline int32_t __SMMLA(int32_t op1, int32_t op2, int32_t op3)
+{
+  return op3 + (int32_t)(((int64_t)op1 * op2) >> 32);
+}
+
+static inline uint32_t __USAT(int32_t value, uint32_t bits)
+{
+  const int32_t max = (1 << bits) - 1;
+  return (value < 0) ? 0 : (value > max) ? max : value;
+}
+#endif
+
+#define FILTER_ADC_BITS   12
+#define FILTER_MAX_OVERSAMPLING 4
+#define FILTER_PAIR_ONES  0x00010001 // SMLAD operand adding both halfwords
+
+/* Read by filterBlock() through Filter.coefficients */
+const FilterCoefficients filterPresets[FILTER_NR_ITEMS] CONTROL_CONST =
+{
+  [FILTER_OFF] =    { 0, FILTER_BYPASS },
+  [FILTER_LIGHT] =  { 1, 0x4000 },
+  [FILTER_MEDIUM] = { 2, 0x2000 },
+  [FILTER_HEAVY] =  { 3, 0x0800 }
+};
+
+static inline uint32_t loadPair(const uint16_t* samples)
+{
+  uint32_t pair;
+  memcpy(&pair, samples, sizeof(pair)); // single LDR, also if unaligned
+  return pair;
+}
+
+/* One IIR step, y += alpha * (x - y), or y = x if bypassed */
+static inline int32_t smooth(const int32_t state, const int32_t x,
+                             const int32_t alpha, const uint8_t bypass)
+{
+  return bypass ? x : __SMMLA((x - state) << 1, alpha, state);
+}
+
+void initFilter(Filter* filter, const FilterCoefficients* coefficients,
+                const uint32_t initialValue)
+{
+  filter->coefficients = coefficients;
+  filter->state = (int32_t)(initialValue << 16);
+  filter->partialSum = 0;
+  filter->partialCount = 0;
+}
+
+/**
+ * Switch coefficients at runtime, takes effect with the next block.
+ * @param filter filter to update
+ * @param coefficients must stay valid while in use, e.g. filterPresets
+ */
+void setFilterCoefficients(Filter* filter,
+                           const FilterCoefficients* coefficients)
+{
+  filter->coefficients = coefficients;
+}
+
+/**
+ * Oversample, decimate and smooth a block of raw ADC samples.
+ * Each window of 2^oversampling samples is summed as halfword pairs with
+ * SMLAD (a moving average, first order CIC), the decimated stream then
+ * runs through the IIR y += alpha * (x - y) with SMMLA. Samples past the
+ * last full window are carried into the next block.
+ * @param filter filter state
+ * @param samples block of 12-bit samples, word aligned is fastest
+ * @param count block length, any
+ * @return latest filtered ADC code
+ */
+uint32_t CONTROL_FUNC filterBlock(Filter* filter, const uint16_t* samples,
+                     const uint32_t count)
+{
+  const FilterCoefficients* coefficients = filter->coefficients;
+  uint32_t oversampling = coefficients->oversampling;
+  const int32_t alpha = (int32_t)coefficients->alpha << 16; // Q31
+  const uint8_t bypass = (coefficients->alpha == FILTER_BYPASS);
+  int32_t state = filter->state;
+  uint32_t partialSum = filter->partialSum;
+  uint32_t partialCount = filter->partialCount;
+
+  if (oversampling > FILTER_MAX_OVERSAMPLING)
+  {
+    oversampling = FILTER_MAX_OVERSAMPLING;
+  }
+
+  const uint32_t window = 1 << oversampling;
+  const uint32_t shift = 16 - oversampling;
+  const uint16_t* end = samples + count;
+
+  /* The window shrank since the last block, start a new one */
+  if (partialCount >= window)
+  {
+    partialSum = 0;
+    partialCount = 0;
+  }
+
+  /* Complete the window the last block left open */
+  if (partialCount > 0)
+  {
+    for (; (samples < end) && (window > partialCount); ++samples)
+    {
+      partialSum += *samples;
+      partialCount++;
+    }
+    if (partialCount == window)
+    {
+      state = smooth(state, (int32_t)(partialSum << shift), alpha, bypass);
+      partialSum = 0;
+      partialCount = 0;
+    }
+  }
+
+  if (window == 1)
+  {
+    for (; samples < end; ++samples)
+    {
+      state = smooth(state, (int32_t)*samples << 16, alpha, bypass);
+    }
+  }
+  else
+  {
+    while (samples + window <= end)
+    {
+      uint32_t sum = 0;
+      for (uint32_t i = 0; window > i; i += 2)
+      {
+        sum = __SMLAD(loadPair(samples + i), FILTER_PAIR_ONES, sum);
+      }
+      samples += window;
+
+      state = smooth(state, (int32_t)(sum << shift), alpha, bypass);
+    }
+  }
+
+  for (; samples < end; ++samples)
+  {
+    partialSum += *samples;
+    partialCount++;
+  }
+
+  filter->state = state;
+  filter->partialSum = partialSum;
+  filter->partialCount = partialCount;
+  return __USAT((state + (1 << 15)) >> 16, FILTER_ADC_BITS);
+}
@@ -1,273 +1,344 @@
 #include "flash.h"
-#include "cmsis_device.h"
+#include "store.h"
+#include "device.h"
+#include "config.h"
+#include "probe.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+#include "task.h"
 #include "diag/Trace.h"
 #include <stdlib.h>
 
+/* A queued commitToFlashBank() */
+typedef struct FlashCommit
+{
+  const FlashBank* bank;
+  const void* data;
+  uint32_t size;
+  FlashCommitHandler handler;
+  void* context;
+} FlashCommit;
+
 static void Flash_Error_Handler(void);
 
-static void eraseFlashSectors(uint32_t begin, uint32_t end);
-static uint32_t getSectorSize(uint32_t Sector);
-static uint32_t getSector(uint32_t address);
 static void testFlash(void);
 
 static void FLASH_Init(void);
 
-static uint32_t FLASH_SECTORS[12] =
-{
-  ((uint32_t)0x08000000), /* Base @ of Sector 0, 16 Kbytes */// used by program
-  ((uint32_t)0x08004000), /* Base @ of Sector 1, 16 Kbytes */// used by program
-  ((uint32_t)0x08008000), /* Base @ of Sector 2, 16 Kbytes */// used by program
-  ((uint32_t)0x0800C000), /* Base @ of Sector 3, 16 Kbytes */// used by program
-  ((uint32_t)0x08010000), /* Base @ of Sector 4, 64 Kbytes */
-  ((uint32_t)0x08020000), /* Base @ of Sector 5, 128 Kbytes */
-  ((uint32_t)0x08040000), /* Base @ of Sector 6, 128 Kbytes */
-  ((uint32_t)0x08060000), /* Base @ of Sector 7, 128 Kbytes */
-  ((uint32_t)0x08080000), /* Base @ of Sector 8, 128 Kbytes */
-  ((uint32_t)0x080A0000), /* Base @ of Sector 9, 128 Kbytes */
-  ((uint32_t)0x080C0000), /* Base @ of Sector 10, 128 Kbytes */
-  ((uint32_t)0x080E0000), /* Base @ of Sector 11, 128 Kbytes */
-};
-
-static uint32_t FLASH_USER_BEGIN = 0x08020000; // sector 5-11
-static uint32_t FLASH_USER_END = 0x080FFFFF; // last K address of flash block
-
-static uint32_t bankFreeSector = 0;
-static uint32_t bankNextSector = 5;
+void flashTask(void const* argument);
+static void waitForFlash(void);
+static void flashOperationDone(void);
+static void maintainFlash(void);
+
 static uint32_t bankNextId = 0;
 
+static osThreadId flashTaskHandle;
+static osMailQId commitQueue;
+
+/* Held while the store is written or compacted, and while a mapped bank is
+ * read, both move records. Not over the erase of a compaction, nothing
+ * indexed is left in that sector. */
+static osMutexId storeLock;
+
+/* Released from the flash interrupt, the flash task sleeps on it while an
+ * erase or program runs */
+static osSemaphoreId flashDone;
+
+volatile uint8_t flashCommitActive = 0;
+
+/* Stack reserved at build time, see osThreadStaticDef() */
+osThreadStaticDef(flashThread, flashTask, osPriorityAboveNormal, 0, 256);
+
 
+/**
+ * Mount the parameter store, then start the flash task. Until the scheduler
+ * runs the store is written by polling.
+ */
 void setupFlash(void)
 {
   FLASH_Init();
+
+  osMutexDef(storeMutex);
+  storeLock = osMutexCreate(osMutex(storeMutex));
+
+  osSemaphoreDef(flashSemaphore);
+  flashDone = osSemaphoreCreate(osSemaphore(flashSemaphore), 1);
+  osSemaphoreWait(flashDone, 0);
+
+  osMailQDef(commitMail, CONFIG_FLASH_COMMIT_QUEUE_SIZE, FlashCommit);
+  commitQueue = osMailCreate(osMailQ(commitMail), NULL);
+
+  flashTaskHandle = osThreadCreate(osThread(flashThread), NULL);
+
+  if ((storeLock == NULL) || (flashDone == NULL) || (commitQueue == NULL)
+      || (flashTaskHandle == NULL))
+  {
+    trace_printf("Out of heap for the flash task\n");
+    Flash_Error_Handler();
+  }
 }
 
+/**
+ * Create a bank, banks are records of the parameter store. Ids are handed
+ * out in order, so create banks in the same order on every boot.
+ * @param size in items
+ * @param itemSize bytes per item
+ * @return bank
+ */
 FlashBank createFlashBank(const uint32_t size, const FlashSize itemSize)
 {
   FlashBank bank;
   bank.id = bankNextId;
   bankNextId++;
-  bank.sector = bankNextSector;
   bank.size = size;
   bank.itemSize = itemSize;
 
-  bankNextSector++;
-  bankFreeSector--;
+  if (bank.id >= STORE_MAX_IDS)
+  {
+    trace_printf("Out of flash banks\n");
+    Flash_Error_Handler();
+  }
 
   return bank;
 }
 
-void readFromFlashBank(void* data, const uint32_t size, const FlashBank* bank)
+/**
+ * Read the last saved items of a bank.
+ * @param data destination
+ * @param size in items
+ * @param bank bank
+ * @return number of items read, 0 if the bank was never written
+ */
+uint32_t readFromFlashBank(void* data, const uint32_t size, const FlashBank* bank)
 {
-  if ((size * bank->itemSize) > (bank->size * bank->itemSize))
-  {
-    return;
-  }
+  uint32_t read;
 
-  __IO uint32_t begin = FLASH_SECTORS[bank->sector];
-  const uint32_t end = begin + (size * bank->itemSize);
-
-  while (begin < end)
+  if (size > bank->size)
   {
-    switch (bank->itemSize)
-    {
-      case FLASH_8B:
-        *((uint8_t*)data) = *(uint8_t*)begin;
-        break;
-      case FLASH_16B:
-        *((uint16_t*)data) = *(uint16_t*)begin;
-        break;
-      case FLASH_32B:
-        *((uint32_t*)data) = *(uint32_t*)begin;
-        break;
-      case FLASH_64B:
-        *((uint64_t*)data) = *(uint64_t*)begin;
-        break;
-      default:
-        break;
-    }
-    begin = begin + bank->itemSize;
-    data = (void*)(((uint8_t*)data) + bank->itemSize);
+    return 0;
   }
+
+  lockFlash();
+  read = (getStoreItemSize(bank->id) == bank->itemSize)
+         ? readStore(bank->id, data, size * bank->itemSize) / bank->itemSize
+         : 0;
+  unlockFlash();
+  return read;
 }
 
-void writeToFlashBank(void* data, const uint32_t size,
-                      const FlashBank* bank)
+/**
+ * Save items to a bank, appends to the store without erasing. Blocks until
+ * written, see commitToFlashBank() to save in the background. Fails while
+ * the flash task erases a compacted sector, from other tasks queue a
+ * commit instead.
+ * @param data source
+ * @param size in items
+ * @param bank bank
+ * @return 1 on success
+ */
+uint8_t writeToFlashBank(const void* data, const uint32_t size,
+                         const FlashBank* bank)
 {
-  if ((size * bank->itemSize) > (bank->size * bank->itemSize))
+  uint8_t written;
+
+  if (size > bank->size)
   {
-    return;
+    return 0;
   }
 
-  __IO uint32_t begin = FLASH_SECTORS[bank->sector];
-  const uint32_t end = begin + (size * bank->itemSize);
+  lockFlash();
+  written = writeStore(bank->id, data, size * bank->itemSize, bank->itemSize);
+  unlockFlash();
+  return written;
+}
 
-  eraseFlashSectors(begin, end);
+/**
+ * Queue a save of items to a bank, the flash task writes it in the
+ * background and then calls handler. Callable from any task.
+ * @param data source, must stay unchanged until handler was called
+ * @param size in items
+ * @param bank bank, must stay valid until handler was called
+ * @param handler result, may be NULL
+ * @param context passed to handler
+ * @return 1 if queued, 0 if the queue is full or size is out of range
+ */
+uint8_t commitToFlashBank(const void* data, const uint32_t size,
+                          const FlashBank* bank, FlashCommitHandler handler,
+                          void* context)
+{
+  FlashCommit* commit;
 
-  HAL_StatusTypeDef unlockstat = HAL_FLASH_Unlock();
-  if (unlockstat == HAL_ERROR)
+  if (size > bank->size)
   {
-    Flash_Error_Handler();
+    return 0;
   }
 
-  HAL_StatusTypeDef flashStatus = HAL_ERROR;
-  while (begin < end)
+  commit = (FlashCommit*)osMailAlloc(commitQueue, 0);
+  if (commit == NULL)
   {
-    switch (bank->itemSize)
-    {
-      case FLASH_8B:
-        flashStatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, begin, *(uint8_t*)data);
-        break;
-      case FLASH_16B:
-        flashStatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, begin, *(uint16_t*)data);
-        break;
-      case FLASH_32B:
-        flashStatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, begin, (*(uint32_t*)data));
-        break;
-      case FLASH_64B:
-        flashStatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, begin, *(uint64_t*)data);
-        break;
-      default:
-      {
-        trace_printf("Unknown item size %i\n", bank->itemSize);
-        Flash_Error_Handler();
-        break;
-      }
-    }
-    if (HAL_OK == flashStatus)
-    {
-      begin = begin + bank->itemSize;
-      data = (void*)(((uint8_t*)data) + bank->itemSize);
-    }
-    else
-    {
-      Flash_Error_Handler();
-    }
+    return 0;
   }
-
-  HAL_FLASH_Lock();
+  commit->bank = bank;
+  commit->data = data;
+  commit->size = size;
+  commit->handler = handler;
+  commit->context = context;
+  return osMailPut(commitQueue, commit) == osOK;
 }
 
-
-static void FLASH_Init(void)
+/**
+ * Map the items of a bank in place, reads go through the flash cache
+ * without a RAM copy. Hold lockFlash() from the call until the last read,
+ * writes and compaction move the items.
+ * @param bank bank
+ * @param size set to the number of items saved, up to bank->size
+ * @return items, NULL if the bank was never saved or is damaged
+ */
+const void* mapFlashBank(const FlashBank* bank, uint32_t* size)
 {
-  bankFreeSector = 11-5;
-  bankNextSector = 5;
+  uint32_t length = 0;
+  const void* data = mapStore(bank->id, &length);
+
+  if ((data == NULL) || (length > (bank->size * bank->itemSize))
+      || (getStoreItemSize(bank->id) != bank->itemSize))
+  {
+    *size = 0;
+    return NULL;
+  }
+  *size = length / bank->itemSize;
+  return data;
 }
 
-static void eraseFlashSectors(uint32_t begin, uint32_t end)
+/**
+ * Look up a saved bank by id, its size and item size come from the store.
+ * @param id bank id
+ * @param bank set to the bank
+ * @return 1 if found, 0 if the id was never saved
+ */
+uint8_t openFlashBank(const uint32_t id, FlashBank* bank)
 {
-  uint32_t FirstSector = 0, NbOfSectors = 0;
-  uint32_t SectorError = 0;
-  FLASH_EraseInitTypeDef EraseInitStruct;
-
-  /* Get the 1st sector to erase */
-  FirstSector = getSector(begin);
-  /* Get the number of sector to erase from 1st sector*/
-  NbOfSectors = getSector(end) - FirstSector + 1;
+  uint32_t size;
+  uint32_t itemSize;
 
-  /* Fill EraseInit structure*/
-  EraseInitStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
-  EraseInitStruct.VoltageRange = FLASH_VOLTAGE_RANGE_3;
-  EraseInitStruct.Sector = FirstSector;
-  EraseInitStruct.NbSectors = NbOfSectors;
+  lockFlash();
+  size = getStoreSize(id);
+  itemSize = getStoreItemSize(id);
+  unlockFlash();
 
-  HAL_FLASH_Unlock();
-
-  if(HAL_FLASHEx_Erase(&EraseInitStruct, &SectorError) != HAL_OK)
+  if ((size == 0) || (itemSize == 0))
   {
-    Flash_Error_Handler();
+    return 0;
   }
-
-  FLASH_FlushCaches();
-
-  HAL_FLASH_Lock();
+  bank->id = id;
+  bank->size = size / itemSize;
+  bank->itemSize = (FlashSize)itemSize;
+  return 1;
 }
 
-static uint32_t getSector(uint32_t address)
+/**
+ * Take the store lock, a no-op before the scheduler runs, main() is the
+ * only task then.
+ */
+void lockFlash(void)
 {
-  uint32_t sector = 0;
-
-  if((address < FLASH_SECTORS[1]) && (address >= FLASH_SECTORS[0]))
-  {
-    sector = FLASH_SECTOR_0;
-  }
-  else if((address < FLASH_SECTORS[2]) && (address >= FLASH_SECTORS[1]))
-  {
-    sector = FLASH_SECTOR_1;
-  }
-  else if((address < FLASH_SECTORS[3]) && (address >= FLASH_SECTORS[2]))
-  {
-    sector = FLASH_SECTOR_2;
-  }
-  else if((address < FLASH_SECTORS[4]) && (address >= FLASH_SECTORS[3]))
-  {
-    sector = FLASH_SECTOR_3;
-  }
-  else if((address < FLASH_SECTORS[5]) && (address >= FLASH_SECTORS[4]))
+  if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED)
   {
-    sector = FLASH_SECTOR_4;
+    osMutexWait(storeLock, osWaitForever);
   }
-  else if((address < FLASH_SECTORS[6]) && (address >= FLASH_SECTORS[5]))
-  {
-    sector = FLASH_SECTOR_5;
-  }
-  else if((address < FLASH_SECTORS[7]) && (address >= FLASH_SECTORS[6]))
-  {
-    sector = FLASH_SECTOR_6;
-  }
-  else if((address < FLASH_SECTORS[8]) && (address >= FLASH_SECTORS[7]))
-  {
-    sector = FLASH_SECTOR_7;
-  }
-  else if((address < FLASH_SECTORS[9]) && (address >= FLASH_SECTORS[8]))
-  {
-    sector = FLASH_SECTOR_8;
-  }
-  else if((address < FLASH_SECTORS[10]) && (address >= FLASH_SECTORS[9]))
-  {
-    sector = FLASH_SECTOR_9;
-  }
-  else if((address < FLASH_SECTORS[11]) && (address >= FLASH_SECTORS[10]))
-  {
-    sector = FLASH_SECTOR_10;
-  }
-  else /* (Address < FLASH_END_ADDR) && (Address >= ADDR_FLASH_SECTOR_11) */
+}
+
+void unlockFlash(void)
+{
+  if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED)
   {
-    sector = FLASH_SECTOR_11;
+    osMutexRelease(storeLock);
   }
-  return sector;
 }
 
 /**
-  * @brief  Gets sector Size
-  * @param  None
-  * @retval The size of a given sector
-  */
-static uint32_t getSectorSize(uint32_t Sector)
+ * Writes the queued commits. Erase and program run from the flash
+ * interrupt while this task sleeps. The single bank stalls every fetch
+ * from the flash meanwhile, code and data, so only what runs from RAM
+ * keeps going: with CONFIG_CONTROL_IN_RAM the control path, as long as
+ * no fetch of other code holds the bus. PROBE_COMMIT_CONTROL_PERIOD
+ * records the control periods of every commit, its max is the worst PWM
+ * update gap a commit caused.
+ */
+void flashTask(void const* argument)
 {
-  uint32_t sectorsize = 0x00;
+  setFlashDoneHandler(flashOperationDone);
+  setFlashWaitHandler(waitForFlash);
 
-  if((Sector == FLASH_SECTOR_0) || (Sector == FLASH_SECTOR_1) || (Sector == FLASH_SECTOR_2) || (Sector == FLASH_SECTOR_3))
-  {
-    sectorsize = 16 * 1024;
-  }
-  else if(Sector == FLASH_SECTOR_4)
+  while (1)
   {
-    sectorsize = 64 * 1024;
+    osEvent event = osMailGet(commitQueue, osWaitForever);
+    if (event.status != osEventMail)
+    {
+      continue;
+    }
+
+    FlashCommit* commit = (FlashCommit*)event.value.p;
+    flashCommitActive = 1;
+    const uint8_t written = writeToFlashBank(commit->data, commit->size,
+                                             commit->bank);
+    if (commit->handler)
+    {
+      commit->handler(commit->bank, written, commit->context);
+    }
+    osMailFree(commitQueue, commit);
+
+    maintainFlash();
+    flashCommitActive = 0;
+
+#if CONFIG_USE_PROBES
+    ProbeStats stats;
+    readProbe(PROBE_COMMIT_CONTROL_PERIOD, &stats);
+    trace_printf("flash: control period max %u cycles during commits\n",
+                 stats.max);
+#endif
   }
-  else
+}
+
+static void waitForFlash(void)
+{
+  osSemaphoreWait(flashDone, osWaitForever);
+}
+
+static void flashOperationDone(void)
+{
+  osSemaphoreRelease(flashDone);
+}
+
+/**
+ * Compact the store ahead of time, so the next writes do not wait for a
+ * sector erase. The lock is released for the erase, yet readers still wait
+ * the 1-2 s it takes: curveTask runs from the flash and mapStore() reads
+ * it, both stall until the erase is done.
+ */
+static void maintainFlash(void)
+{
+  uint32_t sector;
+  uint8_t erase;
+
+  lockFlash();
+  erase = storeNeedsCompaction() && beginCompaction(&sector);
+  unlockFlash();
+
+  if (erase)
   {
-    sectorsize = 128 * 1024;
+    endCompaction(sector);
   }
-  return sectorsize;
 }
 
-static void testFlash(void)
+
+static void FLASH_Init(void)
 {
-  uint32_t begin = 0;
-  uint32_t end = 0;
-  __IO uint32_t data32 = 0;
+  bankNextId = 0;
+  mountStore();
+}
 
+static void testFlash(void)
+{
   FlashBank testBank = createFlashBank(1000, FLASH_32B);
   uint32_t testData[1000];
 
@@ -276,25 +347,9 @@ static void testFlash(void)
     testData[i] = (uint32_t)0xFF;
   }
   trace_printf("Writing test data to flash...0xff\n");
-  writeToFlashBank(testData, 1000, &testBank);
-
-  trace_printf("Testing data from flash...\n");
-
-  begin = FLASH_USER_BEGIN;
-  end = begin + 1000*4;
-  data32 = 0;
-
-  while (begin < end)
+  if (!writeToFlashBank(testData, 1000, &testBank))
   {
-    data32 = *(__IO uint32_t*)begin;
-    if (data32 != (uint32_t)0xFF)
-    {
-      trace_printf("%X", data32);
-      trace_printf("Wrong data read at %X\n", begin);
-      Flash_Error_Handler();
-    }
-
-    begin = begin + 4;
+    Flash_Error_Handler();
   }
 
   for (uint32_t i = 0; 1000 > i; ++i)
@@ -302,31 +357,35 @@ static void testFlash(void)
     testData[i] = (uint32_t)0x12345678;
   }
   trace_printf("Writing test data to flash...0x12345678\n");
-  writeToFlashBank(testData, 1000, &testBank);
+  if (!writeToFlashBank(testData, 1000, &testBank))
+  {
+    Flash_Error_Handler();
+  }
 
   trace_printf("Testing data from flash...\n");
 
-  begin = FLASH_USER_BEGIN;
-  end = begin + 1000*4;
-  data32 = 0;
-
-  while (begin < end)
+  for (uint32_t i = 0; 1000 > i; ++i)
+  {
+    testData[i] = 0;
+  }
+  if (readFromFlashBank(testData, 1000, &testBank) != 1000)
+  {
+    Flash_Error_Handler();
+  }
+  for (uint32_t i = 0; 1000 > i; ++i)
   {
-    data32 = *(__IO uint32_t*)begin;
-    if (data32 != (uint32_t)0x12345678)
+    if (testData[i] != (uint32_t)0x12345678)
     {
-      trace_printf("%X", data32);
-      trace_printf("Wrong data read at %X\n", begin);
+      trace_printf("%X", testData[i]);
+      trace_printf("Wrong data read at %u\n", i);
       Flash_Error_Handler();
     }
-
-    begin = begin + 4;
   }
 }
 
 static void Flash_Error_Handler(void)
 {
-  trace_printf("Flash error: %i", HAL_FLASH_GetError());
+  trace_printf("Flash error: %i", getFlashError());
   while (1)
   {}
 }
@@ -0,0 +1,172 @@
+#include "input.h"
+#include "config.h"
+#include "cmsis_device.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+/*
+ * Debounced inputs on EXTI lines. The interrupt only stamps the edge and
+ * signals the input task, which waits until the line settled, reads it and
+ * signals press, long press and release to the subscribed task. All tasks
+ * block in between, nothing polls.
+ */
+
+typedef enum InputState
+{
+  INPUT_RELEASED = 0,
+  INPUT_HELD,
+  INPUT_LONG_HELD
+} InputState;
+
+typedef struct InputLine
+{
+  GPIO_TypeDef* port;
+  uint16_t pin;                // EXTI line, one input per line
+} InputLine;
+
+typedef struct Input
+{
+  InputState state;
+  volatile uint8_t settling;   // an edge was seen since the last read
+  volatile TickType_t edge;    // tick of the last edge
+  TickType_t pressed;          // tick the press was resolved
+  osThreadId subscriber;
+} Input;
+
+static const InputLine inputLines[INPUT_NR_ITEMS] =
+{
+  [INPUT_USER_BUTTON] = { GPIOA, GPIO_PIN_0 },
+  [INPUT_MODE_DOWN] =   { GPIOC, GPIO_PIN_3 },
+  [INPUT_MODE_UP] =     { GPIOA, GPIO_PIN_4 },
+  [INPUT_AUX] =         { GPIOA, GPIO_PIN_2 }
+};
+
+static Input inputs[INPUT_NR_ITEMS];
+static osThreadId inputTaskHandle = NULL;
+
+void inputTask(void const* argument);
+static TickType_t resolveInput(const uint32_t id, const TickType_t now);
+
+/* Stack reserved at build time, see osThreadStaticDef() */
+osThreadStaticDef(inputThread, inputTask, osPriorityHigh, 0, 128);
+
+/**
+ * Start the input task, before the EXTI interrupts can fire.
+ */
+void setupInput(void)
+{
+  inputTaskHandle = osThreadCreate(osThread(inputThread), NULL);
+}
+
+/**
+ * Send the events of an input to a task as INPUT_SIGNAL() signals.
+ * @param id input
+ * @param task receives the events, NULL to drop them
+ */
+void subscribeInput(const InputId id, osThreadId task)
+{
+  if (id < INPUT_NR_ITEMS)
+  {
+    inputs[id].subscriber = task;
+  }
+}
+
+/**
+ * Stamp an edge of an input line, from its EXTI interrupt.
+ * @param pin EXTI line, lines without an input are ignored
+ */
+void inputEdge(const uint16_t pin)
+{
+  for (uint32_t id = 0; INPUT_NR_ITEMS > id; ++id)
+  {
+    if (inputLines[id].pin == pin)
+    {
+      inputs[id].edge = xTaskGetTickCountFromISR();
+      inputs[id].settling = 1;
+      if (inputTaskHandle)
+      {
+        osSignalSet(inputTaskHandle, 1);
+      }
+      return;
+    }
+  }
+}
+
+/**
+ * Resolves the inputs, sleeps until the next edge or until the nearest
+ * debounce or long press deadline.
+ */
+void inputTask(void const* argument)
+{
+  uint32_t timeout = osWaitForever;
+
+  while (1)
+  {
+    osSignalWait(1, timeout);
+
+    const TickType_t now = xTaskGetTickCount();
+    TickType_t wait = portMAX_DELAY;
+    for (uint32_t id = 0; INPUT_NR_ITEMS > id; ++id)
+    {
+      const TickType_t next = resolveInput(id, now);
+      if (next < wait)
+      {
+        wait = next;
+      }
+    }
+    timeout = (wait == portMAX_DELAY) ? osWaitForever : (wait * portTICK_PERIOD_MS);
+  }
+}
+
+static void signalInput(const uint32_t id, const InputEvent event)
+{
+  if (inputs[id].subscriber)
+  {
+    osSignalSet(inputs[id].subscriber, INPUT_SIGNAL(id, event));
+  }
+}
+
+/**
+ * Debounce state machine of an input.
+ * @return ticks until it needs to run again, portMAX_DELAY for the next edge
+ */
+static TickType_t resolveInput(const uint32_t id, const TickType_t now)
+{
+  Input* input = &inputs[id];
+
+  if (input->settling)
+  {
+    const TickType_t settled = now - input->edge;
+    if (settled < pdMS_TO_TICKS(CONFIG_INPUT_DEBOUNCE_MS))
+    {
+      return pdMS_TO_TICKS(CONFIG_INPUT_DEBOUNCE_MS) - settled;
+    }
+    input->settling = 0;
+
+    const uint8_t level = HAL_GPIO_ReadPin(inputLines[id].port,
+                                           inputLines[id].pin) == GPIO_PIN_SET;
+    if (level && (input->state == INPUT_RELEASED))
+    {
+      input->state = INPUT_HELD;
+      input->pressed = now;
+      signalInput(id, INPUT_PRESS);
+    }
+    else if (!level && (input->state != INPUT_RELEASED))
+    {
+      input->state = INPUT_RELEASED;
+      signalInput(id, INPUT_RELEASE);
+    }
+  }
+
+  if (input->state == INPUT_HELD)
+  {
+    const TickType_t held = now - input->pressed;
+    if (held < pdMS_TO_TICKS(CONFIG_INPUT_LONG_PRESS_MS))
+    {
+      return pdMS_TO_TICKS(CONFIG_INPUT_LONG_PRESS_MS) - held;
+    }
+    input->state = INPUT_LONG_HELD;
+    signalInput(id, INPUT_LONG_PRESS);
+  }
+  return portMAX_DELAY;
+}
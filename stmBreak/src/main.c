@@ -2,10 +2,21 @@
 #include "main.h"
 #include "device.h"
 #include "flash.h"
+#include "backup.h"
+#include "input.h"
+#include "curve.h"
+#include "filter.h"
+#include "telemetry.h"
+#include "serial.h"
+#include "protocol.h"
+#include "benchmark.h"
+#include "command.h"
+#include "probe.h"
+#include "config.h"
 #include "cmsis_os.h"
 #include "diag/Trace.h"
-#include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* Peripheral handles --------------------------------------------------------*/
 
@@ -13,29 +24,90 @@
 static FlashBank userBank1;
 static FlashBank userBank2;
 static FlashBank userBank3;
-static uint16_t functionLUT[1000];
 
-osThreadId adcTaskHandle;
+/* Lever position after the filter stage, consumed by the control loop */
+static Filter leverFilter;
+static volatile uint32_t leverValue = 0;
+
+osThreadId curveTaskHandle;
 osThreadId usartTaskHandle;
 osThreadId userButtonTaskHandle;
+osThreadId commandTaskHandle;
 
 osPoolId paramPoolId;
-osMessageQId adcMessageQ;
+
+/* Cycles from setupDevice() to the first control loop, reported once by
+ * curveTask */
+volatile uint32_t firstPwmCycles = 0;
+
+#if CONFIG_USE_RUNTIME_STATS
+/* Read by reportRuntimeStats(), or by a debugger */
+volatile uint32_t controlIterations = 0;
+volatile uint32_t controlCycles = 0;
+#endif
+
+/* Control loop to usartTask, written from the TIM1 update interrupt */
+static TelemetryRing telemetryRing CCM_BSS;
+
+#if CONFIG_USE_CCM
+/* FreeRTOS heap, thread control blocks, the idle stack, queues and
+ * semaphores come from here. Thread stacks and pools are static, see
+ * osStaticSection */
+uint8_t ucHeap[configTOTAL_HEAP_SIZE] CCM_NOINIT;
+#endif
+
+#define CURVE_UPDATE_SIGNAL 0x01
 
 
 /* Structs and typedefs ------------------------------------------------------*/
 typedef struct TaskParameter
 {
-  osMessageQId messageQ;
+  TelemetryRing* telemetry;
 } TaskParameter;
 
 /* Function prototypes -------------------------------------------------------*/
 static void Error_Handler(void);
+static TaskParameter* allocTaskParameter(void);
 
-void adcTask(void const* argument);
+void curveTask(void const* argument);
 void usartTask(void const* argument);
 void userButtonTask(void const* argument);
 
+static uint8_t isUserFunction(const uint32_t function);
+static void selectFunction(const BrakeFunction function);
+static void curveChanged(const BrakeFunction function);
+static void updateCurve(void);
+static void restoreRuntimeState(void);
+static void saveRuntimeState(void);
+static void stepBrakeFunction(const uint32_t step);
+static void CONTROL_FUNC adcBlockReady(const uint16_t* samples, uint32_t count);
+
+/* Threads and pools ---------------------------------------------------------*/
+/* Stacks and pool items are reserved at build time in osStaticSection, the
+ * heap only holds the thread control blocks */
+osThreadStaticDef(curveThread, curveTask, osPriorityBelowNormal, 0, 128);
+osThreadStaticDef(usartThread, usartTask, osPriorityRealtime, 0, 128);
+osThreadStaticDef(userButtonThread, userButtonTask, osPriorityHigh, 0, 128);
+osThreadStaticDef(commandThread, commandTask, osPriorityNormal, 0, 256);
+osPoolStaticDef(paramPool, 8, TaskParameter);
+
+/* User curves are read in place from their flash banks */
+static FlashBank* const userBank[BF_NR_ITEMS] =
+{
+  [BF_USER1] = &userBank1,
+  [BF_USER2] = &userBank2,
+  [BF_USER3] = &userBank3
+};
+
+/* Command frames act on these, see command.c */
+static const CommandTarget commandTarget =
+{
+  userBank,
+  &leverFilter,
+  selectFunction,
+  curveChanged
+};
+
 /* Main ----------------------------------------------------------------------*/
 /**
  * main
@@ -44,39 +116,64 @@ void userButtonTask(void const* argument);
 int main(void)
 {
   setupDevice();
+  setupBackup();
+  restoreRuntimeState();
   setupFlash();
+  setupSerial();
+  setupInput();
+
+#if CONFIG_USE_BENCHMARKS
+  runBenchmarks();
+#endif
+#if CONFIG_USE_PROBES
+  resetProbes();
+#endif
 
   /* Create flash memory for loading and saving user functions */
-  userBank1 = createFlashBank(1000, FLASH_16B);
-  userBank2 = createFlashBank(1000, FLASH_16B);
-  userBank3 = createFlashBank(1000, FLASH_16B);
+  /* Saved encoded, see encodeCurve() */
+  userBank1 = createFlashBank(CURVE_CODE_SIZE, FLASH_8B);
+  userBank2 = createFlashBank(CURVE_CODE_SIZE, FLASH_8B);
+  userBank3 = createFlashBank(CURVE_CODE_SIZE, FLASH_8B);
 
-  /* Load user data from flash banks */
-  readFromFlashBank(functionLUT, 1000, &userBank1);
+  /* The control loop starts with the scheduler, give it a valid curve.
+   * Only the default one, user curves are decoded on their first selection */
+  updateCurve();
+
+  /* Filter every ADC block ahead of the control loop */
+  initFilter(&leverFilter, &filterPresets[CONFIG_FILTER_PRESET], getAdc());
+  setAdcBlockHandler(adcBlockReady);
 
   /* Create memory pools */
-  osPoolDef(paramPool, 8, TaskParameter);
   paramPoolId = osPoolCreate(osPool(paramPool));
+  if (paramPoolId == NULL)
+  {
+    Error_Handler();
+  }
 
-  /* Create message queues */
-  osMessageQDef(adcQ, 16, uint32_t);
-  adcMessageQ = osMessageCreate(osMessageQ(adcQ), NULL);
+  /* Create the telemetry ring */
+  initTelemetry(&telemetryRing);
 
   /* Create the thread(s) */
-  TaskParameter* adcParameter = (TaskParameter*)osPoolAlloc(paramPoolId);
-  adcParameter->messageQ = adcMessageQ;
-  osThreadDef(adcThread, adcTask, osPriorityHigh, 0, 128);
-  adcTaskHandle = osThreadCreate(osThread(adcThread), adcParameter);
+  curveTaskHandle = osThreadCreate(osThread(curveThread), allocTaskParameter());
+
+  usartTaskHandle = osThreadCreate(osThread(usartThread), allocTaskParameter());
+
+  userButtonTaskHandle = osThreadCreate(osThread(userButtonThread), allocTaskParameter());
+  subscribeInput(INPUT_USER_BUTTON, userButtonTaskHandle);
+  subscribeInput(INPUT_MODE_DOWN, userButtonTaskHandle);
+  subscribeInput(INPUT_MODE_UP, userButtonTaskHandle);
 
-  TaskParameter* uartParameter = (TaskParameter*)osPoolAlloc(paramPoolId);
-  uartParameter->messageQ = adcMessageQ;
-  osThreadDef(usartThread, usartTask, osPriorityRealtime, 0, 128);
-  usartTaskHandle = osThreadCreate(osThread(usartThread), uartParameter);
+  setupCommands(&commandTarget);
+  commandTaskHandle = osThreadCreate(osThread(commandThread), NULL);
 
-  TaskParameter* userButtonParameter = (TaskParameter*)osPoolAlloc(paramPoolId);
-  userButtonParameter->messageQ = adcMessageQ;
-  osThreadDef(userButtonThread, userButtonTask, osPriorityHigh, 0, 128);
-  userButtonTaskHandle = osThreadCreate(osThread(userButtonThread), userButtonParameter);
+  if ((curveTaskHandle == NULL) || (usartTaskHandle == NULL)
+      || (userButtonTaskHandle == NULL) || (commandTaskHandle == NULL))
+  {
+    Error_Handler();
+  }
+
+  /* Everything the control loop touches exists now */
+  startControlLoop();
 
   /* Start scheduler */
   osKernelStart();
@@ -90,146 +187,380 @@ int main(void)
 uint32_t brakeMaxValue = 1000;
 uint32_t brakeMinValue = 0;
 
-static float functionOff(const float x)
+/* Kept over resets in backup SRAM, see backup.c */
+typedef struct RuntimeState
 {
-  return 0;
-}
+  uint32_t brakeFunction;
+  uint32_t brakeMinValue;
+  uint32_t brakeMaxValue;
+  uint32_t bootCount;
+  uint32_t curveSwitches; // selected function or limits changed
+} RuntimeState;
 
-static float functionOn(const float x)
-{
-  return brakeMaxValue;
-}
+static RuntimeState runtimeState;
 
-static float functionLinear(const float x)
-{
-  return x;
-}
+/* Set per function when its user data changed, the limits and function
+ * alone do not tell */
+static volatile uint8_t curveDataChanged[BF_NR_ITEMS];
 
-static float functionToggle(const float x)
-{
-  return (((int) (x + 0.5)) % 2) ? brakeMinValue : brakeMaxValue;
-}
+BrakeFunction brakeFunction = BF_OFF;
 
-static float functionExp(const float x, const uint8_t p)
+/*
+ * Duty cycle per ADC code. Tables are built on the first selection of a
+ * function and kept for the next switch back, the least recently used one
+ * is replaced. The active table is never rebuilt in place, so the control
+ * path always reads a complete one.
+ */
+typedef struct CurveCacheEntry
 {
-  //return brakeMaxValue - (((powf(brakeMaxValue - x, p)) / powf(brakeMaxValue, p)) * brakeMaxValue);
-  return brakeMaxValue - powf(brakeMaxValue - x, p);
-}
+  Curve parameter;   // function and limits the table was built for
+  uint32_t lastUse;  // curveCacheClock at the last selection, 0 if empty
+} CurveCacheEntry;
 
-static float functionExp2(const float x)
-{
-  return functionExp(x, 2);
-}
+#if CONFIG_CURVE_CACHE_SIZE < 2
+#error "CONFIG_CURVE_CACHE_SIZE needs a table besides the active one"
+#endif
 
-static float functionExp3(const float x)
-{
-  return functionExp(x, 2);
-}
+static uint16_t curveTables[CONFIG_CURVE_CACHE_SIZE][CURVE_SIZE] CCM_BSS;
+static CurveCacheEntry curveCache[CONFIG_CURVE_CACHE_SIZE];
+static uint32_t curveCacheClock = 0;
+static const uint16_t* volatile activeCurve = curveTables[0];
 
-static float functionExp4(const float x)
+/**
+ * Publish the duty cycle table of the brake function and its limits to the
+ * control path, from the cache or built if it is not cached.
+ */
+static void updateCurve(void)
 {
-  return functionExp(x, 2);
+  Curve curve;
+  curve.function = brakeFunction;
+  curve.minValue = brakeMinValue;
+  curve.maxValue = brakeMaxValue;
+  curve.userData = NULL;
+  curve.userSize = 0;
+  curve.userPoints = NULL;
+
+  /* Drop tables of changed user data, the active one stays until replaced */
+  for (uint32_t function = 0; BF_NR_ITEMS > function; ++function)
+  {
+    if (!curveDataChanged[function])
+    {
+      continue;
+    }
+    curveDataChanged[function] = 0;
+    for (uint32_t i = 0; CONFIG_CURVE_CACHE_SIZE > i; ++i)
+    {
+      if (curveCache[i].parameter.function == function)
+      {
+        curveCache[i].lastUse = 0;
+      }
+    }
+  }
+
+  uint32_t slot = CONFIG_CURVE_CACHE_SIZE;
+  for (uint32_t i = 0; CONFIG_CURVE_CACHE_SIZE > i; ++i)
+  {
+    const CurveCacheEntry* entry = &curveCache[i];
+    if ((entry->lastUse != 0)
+        && (entry->parameter.function == curve.function)
+        && (entry->parameter.minValue == curve.minValue)
+        && (entry->parameter.maxValue == curve.maxValue))
+    {
+      curveCache[i].lastUse = ++curveCacheClock;
+      activeCurve = curveTables[i];
+      return;
+    }
+    if ((curveTables[i] != activeCurve)
+        && ((slot == CONFIG_CURVE_CACHE_SIZE)
+            || (entry->lastUse < curveCache[slot].lastUse)))
+    {
+      slot = i;
+    }
+  }
+
+  uint16_t* table = curveTables[slot];
+
+  /* A user curve never saved maps to NULL and evaluates as zeros, a saved
+   * one is decoded straight from the flash while building the table. Only
+   * those wait for the store, built in curves do not touch it. */
+  const uint8_t userCurve = isUserFunction(curve.function);
+  if (userCurve)
+  {
+    lockFlash();
+    curve.userData = (const uint8_t*)mapFlashBank(userBank[curve.function],
+                                                   &curve.userSize);
+  }
+  PROBE_BEGIN(PROBE_CURVE_BUILD);
+  buildCurveTable(table, &curve);
+  PROBE_END(PROBE_CURVE_BUILD);
+  if (userCurve)
+  {
+    unlockFlash();
+  }
+
+  curve.userData = NULL;
+  curve.userSize = 0;
+  curveCache[slot].parameter = curve;
+  curveCache[slot].lastUse = ++curveCacheClock;
+  activeCurve = table;
 }
 
-static float functionUser(const float x, const uint16_t* userData)
+/**
+ * Select the brake function and limits of before the reset, once at boot.
+ */
+static void restoreRuntimeState(void)
 {
-  return userData[(uint16_t)(x + 0.5f)];
-}
+  const uint32_t start = getCycleCount();
 
-static uint16_t userData1[1000] = {0};
-static uint16_t userData2[1000] = {0};
-static uint16_t userData3[1000] = {0};
+  if ((loadBackup(&runtimeState, sizeof(runtimeState)) == sizeof(runtimeState))
+      && (runtimeState.brakeFunction < BF_NR_ITEMS)
+      && (runtimeState.brakeMinValue <= runtimeState.brakeMaxValue))
+  {
+    brakeFunction = (BrakeFunction)runtimeState.brakeFunction;
+    brakeMinValue = runtimeState.brakeMinValue;
+    brakeMaxValue = runtimeState.brakeMaxValue;
+  }
+  else
+  {
+    memset(&runtimeState, 0, sizeof(runtimeState));
+    runtimeState.brakeFunction = brakeFunction;
+    runtimeState.brakeMinValue = brakeMinValue;
+    runtimeState.brakeMaxValue = brakeMaxValue;
+  }
+  runtimeState.bootCount++;
+  saveBackup(&runtimeState, sizeof(runtimeState));
 
-static float functionUser1(const float x)
-{
-  return functionUser(x, userData1);
+  trace_printf("boot %u, function %u restored in %u cycles\n",
+               runtimeState.bootCount, runtimeState.brakeFunction,
+               getCycleCount() - start);
 }
 
-static float functionUser2(const float x)
+/**
+ * Save the brake function and limits when they changed, from curveTask.
+ */
+static void saveRuntimeState(void)
 {
-  return functionUser(x, userData2);
+  if ((runtimeState.brakeFunction == (uint32_t)brakeFunction)
+      && (runtimeState.brakeMinValue == brakeMinValue)
+      && (runtimeState.brakeMaxValue == brakeMaxValue))
+  {
+    return;
+  }
+  runtimeState.brakeFunction = brakeFunction;
+  runtimeState.brakeMinValue = brakeMinValue;
+  runtimeState.brakeMaxValue = brakeMaxValue;
+  runtimeState.curveSwitches++;
+  saveBackup(&runtimeState, sizeof(runtimeState));
 }
 
-static float functionUser3(const float x)
+/**
+ * Called from the ADC1 DMA interrupt with a half of the sample ring.
+ * @param samples finished block, valid until the DMA wraps around
+ * @param count number of samples in the block
+ */
+static void CONTROL_FUNC adcBlockReady(const uint16_t* samples, uint32_t count)
 {
-  return functionUser(x, userData3);
+  PROBE_BEGIN(PROBE_ACQUISITION);
+  leverValue = filterBlock(&leverFilter, samples, count);
+  PROBE_END(PROBE_ACQUISITION);
 }
 
-float (*brakeFunctions[BF_NR_ITEMS+1])(float) =
+/**
+ * Brake control loop, runs from the TIM1 update interrupt once per PWM
+ * period. CCR2 is preloaded, so the duty cycle computed from the latest
+ * filtered sample is output from the next PWM period on.
+ */
+void CONTROL_FUNC controlLoop(void)
 {
-  [BF_OFF] =    functionOff,
-  [BF_ON] =     functionOn,
+#if CONFIG_USE_RUNTIME_STATS
+  const uint32_t controlStart = getCycleCount();
+#endif
+#if CONFIG_USE_PROBES
+  static uint32_t lastControlLoop = 0;
+  const uint32_t now = getCycleCount();
+  if (lastControlLoop != 0)
+  {
+    recordProbe(PROBE_CONTROL_PERIOD, now - lastControlLoop);
+    if (flashCommitActive)
+    {
+      recordProbe(PROBE_COMMIT_CONTROL_PERIOD, now - lastControlLoop);
+    }
+  }
+  lastControlLoop = now;
+#endif
 
-  [BF_LINEAR] = functionLinear,
+  PROBE_BEGIN(PROBE_CONTROL_LOOP);
 
-  [BF_EXP2] =   functionExp2,
-  [BF_EXP3] =   functionExp3,
-  [BF_EXP4] =   functionExp4,
+  PROBE_BEGIN(PROBE_CURVE_LOOKUP);
+  const uint32_t adcValue = leverValue;
+  const uint32_t dutyCycle = activeCurve[adcValue & (CURVE_SIZE - 1)];
+  PROBE_END(PROBE_CURVE_LOOKUP);
 
-  [BF_TOGGLE] = functionToggle,
+  TelemetrySample sample;
 
-  [BF_USER1] =  functionUser1,
-  [BF_USER2] =  functionUser2,
-  [BF_USER3] =  functionUser3,
+  PROBE_BEGIN(PROBE_SET_PWM);
+  setPwm(dutyCycle);
+  PROBE_END(PROBE_SET_PWM);
 
-  [BF_NR_ITEMS] = functionOff
-};
+  PROBE_BEGIN(PROBE_TELEMETRY);
+  sample.timestamp = getCycleCount();
+  sample.adcValue = adcValue;
+  sample.dutyCycle = dutyCycle;
+  pushTelemetry(&telemetryRing, &sample);
+  PROBE_END(PROBE_TELEMETRY);
 
-BrakeFunction brakeFunction = BF_OFF;
+  PROBE_END(PROBE_CONTROL_LOOP);
 
+  if (firstPwmCycles == 0)
+  {
+    firstPwmCycles = getCycleCount();
+  }
+#if CONFIG_USE_RUNTIME_STATS
+  controlIterations++;
+  controlCycles += getCycleCount() - controlStart;
+#endif
+}
 
-void adcTask(void const* argument)
+/**
+ * Ask curveTask to rebuild the duty cycle table, callable from interrupts.
+ */
+void requestCurveUpdate(void)
 {
-  const TaskParameter* parameter = (TaskParameter*)argument;
-  uint32_t adcRaw;
-  float adcValue;
-  register uint32_t dutyCycle;
+  if (curveTaskHandle)
+  {
+    osSignalSet(curveTaskHandle, CURVE_UPDATE_SIGNAL);
+  }
+}
+
+/**
+ * Rebuilds the duty cycle table outside of the control loop, on request
+ * or periodically to pick up changed brake limits.
+ */
+void curveTask(void const* argument)
+{
+#if CONFIG_USE_RUNTIME_STATS
+  uint32_t lastReport = osKernelSysTick();
+#endif
+
+  uint8_t firstPwmReported = 0;
+
+#if CONFIG_USE_TICK_TEST
+  runTickTest();
+#endif
+
   while (1)
   {
-    trace_printf("ADC\n");
-    adcRaw = getAdc();
-    adcValue = brakeMaxValue - ((((adcRaw + 1) / 4096.0f) * brakeMaxValue) * 2);
-    //functions[brakeFunction](adcValue) + 0.5f;
-    dutyCycle = (*brakeFunctions[brakeFunction])(adcValue) + 0.5f;
+    osSignalWait(CURVE_UPDATE_SIGNAL, CONFIG_CURVE_UPDATE_PERIOD_MS);
     trace_printf("function: %i\n", brakeFunction);
-    setPwm(dutyCycle);
-    osMessagePut(parameter->messageQ, dutyCycle, 0);
-//    trace_printf ("ADC raw: %i\nADC input: x = %i\nDutyCycle output: y = %i\n",
-//                  adcRaw, (int) adcValue, dutyCycle);
+    updateCurve();
+    saveRuntimeState();
+
+    if (!firstPwmReported && (firstPwmCycles != 0))
+    {
+      firstPwmReported = 1;
+      trace_printf("first PWM after %u cycles\n", firstPwmCycles);
+      /* All objects exist once the scheduler runs, the idle task included.
+       * Queues, mutexes and semaphores still come from the heap, FreeRTOS
+       * 8.2.3 cannot create them static, this is the margin they leave. */
+      trace_printf("heap: %u of %u bytes never used\n",
+                   xPortGetMinimumEverFreeHeapSize(), configTOTAL_HEAP_SIZE);
+    }
+
+#if CONFIG_USE_RUNTIME_STATS
+    if ((osKernelSysTick() - lastReport) >= osKernelSysTickMicroSec(CONFIG_RUNTIME_STATS_PERIOD_MS * 1000))
+    {
+      lastReport = osKernelSysTick();
+      reportRuntimeStats(controlIterations, controlCycles, firstPwmCycles);
+    }
+#endif
   }
 }
 
 void usartTask(void const* argument)
 {
   const TaskParameter* parameter = (TaskParameter*)argument;
+  static TelemetrySample batch[CONFIG_TELEMETRY_BATCH_SIZE];
+  uint32_t count;
   while (1)
   {
-    trace_printf("UART\n");
-    osEvent data = osMessageGet(parameter->messageQ, 1000);
-    trace_printf("%i\n", data.value.v);
-    uartSend(data.value.p, 4);
+    osDelay(CONFIG_TELEMETRY_PERIOD_MS);
+    while ((count = readTelemetry(parameter->telemetry, batch,
+                                  CONFIG_TELEMETRY_BATCH_SIZE)) > 0)
+    {
+      sendFrame(FRAME_TELEMETRY, batch, count * sizeof(TelemetrySample));
+    }
   }
 }
 
+static uint8_t isUserFunction(const uint32_t function)
+{
+  return (function < BF_NR_ITEMS) && (userBank[function] != NULL);
+}
+
+/**
+ * FRAME_SELECT_FUNCTION, called from commandTask.
+ */
+static void selectFunction(const BrakeFunction function)
+{
+  brakeFunction = function;
+  requestCurveUpdate();
+}
+
+/**
+ * A user curve was committed to its flash bank, called from the flash task.
+ */
+static void curveChanged(const BrakeFunction function)
+{
+  curveDataChanged[function] = 1;
+  requestCurveUpdate();
+}
+
 void userButtonTask(void const* argument)
 {
   const TaskParameter* parameter = (TaskParameter*)argument;
   while (1)
   {
-    trace_printf("BUTTON\n");
+    const osEvent event = osSignalWait(INPUT_SIGNALS(INPUT_USER_BUTTON)
+                                       | INPUT_SIGNALS(INPUT_MODE_DOWN)
+                                       | INPUT_SIGNALS(INPUT_MODE_UP),
+                                       osWaitForever);
+    if (event.status != osEventSignal)
+    {
+      continue;
+    }
 
-    if (isButtonOnBoardPressed())
+    if (event.value.signals & INPUT_SIGNAL(INPUT_USER_BUTTON, INPUT_PRESS))
     {
       ledOnBoardOn();
     }
-    else
+    if (event.value.signals & INPUT_SIGNAL(INPUT_USER_BUTTON, INPUT_LONG_PRESS))
+    {
+      trace_printf("BUTTON long press\n");
+    }
+    if (event.value.signals & INPUT_SIGNAL(INPUT_USER_BUTTON, INPUT_RELEASE))
     {
       ledOnBoardOff();
     }
-    osThreadYield();
+    if (event.value.signals & INPUT_SIGNAL(INPUT_MODE_DOWN, INPUT_PRESS))
+    {
+      stepBrakeFunction(BF_NR_ITEMS - 1);
+    }
+    if (event.value.signals & INPUT_SIGNAL(INPUT_MODE_UP, INPUT_PRESS))
+    {
+      stepBrakeFunction(1);
+    }
   }
 }
 
+/**
+ * Select the brake function step places further, wrapping around.
+ */
+static void stepBrakeFunction(const uint32_t step)
+{
+  brakeFunction = (BrakeFunction)((brakeFunction + step) % BF_NR_ITEMS);
+  requestCurveUpdate();
+}
+
 /**
  * @brief  This function is executed in case of error occurrence.
  * @param  None
@@ -242,6 +573,21 @@ static void Error_Handler(void)
   }
 }
 
+/**
+ * @return parameter of a task, from paramPoolId, never NULL
+ */
+static TaskParameter* allocTaskParameter(void)
+{
+  TaskParameter* parameter = (TaskParameter*)osPoolAlloc(paramPoolId);
+
+  if (parameter == NULL)
+  {
+    Error_Handler();
+  }
+  parameter->telemetry = &telemetryRing;
+  return parameter;
+}
+
 #ifdef USE_FULL_ASSERT
 
 /**
@@ -0,0 +1,72 @@
+#include "probe.h"
+#include "section.h"
+
+#if CONFIG_USE_PROBES
+
+ProbeData probeData[PROBE_NR_ITEMS] CCM_BSS;
+
+/**
+ * Clear all probes, called once from main() before the probes run.
+ */
+void resetProbes(void)
+{
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  for (uint32_t id = 0; PROBE_NR_ITEMS > id; ++id)
+  {
+    ProbeData* data = &probeData[id];
+    data->count = 0;
+    data->sum = 0;
+    data->min = UINT32_MAX;
+    data->max = 0;
+#if CONFIG_USE_PROBE_HISTOGRAM
+    for (uint32_t i = 0; PROBE_BUCKETS > i; ++i)
+    {
+      data->histogram[i] = 0;
+    }
+#endif
+  }
+
+  __set_PRIMASK(primask);
+}
+
+/**
+ * Take a consistent copy of a probe, its interrupt may record meanwhile.
+ * @param id probe
+ * @param stats filled with the statistics since the last reset
+ */
+void readProbe(const ProbeId id, ProbeStats* stats)
+{
+  const ProbeData* data = &probeData[id];
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  stats->count = data->count;
+  stats->min = data->min;
+  stats->max = data->max;
+  stats->sum = data->sum;
+  for (uint32_t i = 0; PROBE_BUCKETS > i; ++i)
+  {
+#if CONFIG_USE_PROBE_HISTOGRAM
+    stats->histogram[i] = data->histogram[i];
+#else
+    stats->histogram[i] = 0;
+#endif
+  }
+
+  __set_PRIMASK(primask);
+
+#if CONFIG_USE_PROBE_HISTOGRAM
+  for (uint32_t i = 0; PROBE_BUCKETS > i; ++i)
+  {
+    stats->count += stats->histogram[i];
+  }
+#endif
+  if (stats->count == 0)
+  {
+    stats->min = 0;
+  }
+}
+
+#endif /* CONFIG_USE_PROBES */
@@ -0,0 +1,177 @@
+#include "protocol.h"
+
+/**
+ * CRC-16/CCITT-FALSE, polynomial 0x1021, bitwise.
+ * @param data bytes to add
+ * @param size number of bytes
+ * @param crc running value, CRC16_INIT for a new checksum
+ * @return updated checksum
+ */
+uint16_t crc16(const uint8_t* data, const uint32_t size, uint16_t crc)
+{
+  for (uint32_t i = 0; size > i; ++i)
+  {
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint32_t bit = 0; 8 > bit; ++bit)
+    {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+/**
+ * CRC-32 as computed by the STM32 CRC unit: polynomial 0x04C11DB7, not
+ * reflected, over little endian words, no final XOR. A last partial word
+ * is padded with zeros. computeCrc() runs it on the CRC unit.
+ * @param data bytes to add
+ * @param size number of bytes
+ * @param crc running value, CRC32_INIT for a new checksum
+ * @return updated checksum
+ */
+uint32_t crc32(const uint8_t* data, const uint32_t size, uint32_t crc)
+{
+  for (uint32_t i = 0; size > i; i += 4)
+  {
+    uint32_t word = 0;
+    for (uint32_t byte = 0; (4 > byte) && (size > (i + byte)); ++byte)
+    {
+      word |= (uint32_t)data[i + byte] << (8 * byte);
+    }
+
+    crc ^= word;
+    for (uint32_t bit = 0; 32 > bit; ++bit)
+    {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+/**
+ * Consistent overhead byte stuffing, removes every 0x00 from data.
+ * @param data raw bytes
+ * @param size number of raw bytes
+ * @param out at least size + size / 254 + 1 bytes
+ * @return encoded length, without delimiter
+ */
+uint32_t cobsEncode(const uint8_t* data, const uint32_t size, uint8_t* out)
+{
+  uint32_t code = 0;  // position of the current block's length byte
+  uint32_t length = 1;
+  uint8_t run = 1;
+
+  for (uint32_t i = 0; size > i; ++i)
+  {
+    if (data[i] != 0)
+    {
+      out[length++] = data[i];
+      run++;
+    }
+    if ((data[i] == 0) || (run == 0xFF))
+    {
+      out[code] = run;
+      code = length++;
+      run = 1;
+    }
+  }
+  out[code] = run;
+  return length;
+}
+
+/**
+ * Undo cobsEncode().
+ * @param data encoded bytes, without delimiter
+ * @param size number of encoded bytes
+ * @param out at least size bytes
+ * @return decoded length, 0 if data is malformed
+ */
+uint32_t cobsDecode(const uint8_t* data, const uint32_t size, uint8_t* out)
+{
+  uint32_t length = 0;
+  uint32_t i = 0;
+
+  while (i < size)
+  {
+    const uint8_t run = data[i++];
+    if ((run == 0) || ((i + run - 1) > size))
+    {
+      return 0;
+    }
+    for (uint32_t j = 1; run > j; ++j)
+    {
+      out[length++] = data[i++];
+    }
+    if ((run != 0xFF) && (i < size))
+    {
+      out[length++] = 0;
+    }
+  }
+  return length;
+}
+
+/**
+ * Build a complete wire frame, header, payload and CRC, COBS encoded and
+ * terminated by FRAME_DELIMITER.
+ * @param type frame type
+ * @param sequence per sender frame counter
+ * @param payload frame payload
+ * @param size payload size
+ * @param out FRAME_ENCODED_SIZE(size) bytes
+ * @return wire length including the delimiter
+ */
+uint32_t encodeFrame(const FrameType type, const uint16_t sequence,
+                     const void* payload, const uint32_t size, uint8_t* out)
+{
+  /* Assemble in place behind the worst case encoding overhead, COBS never
+   * writes ahead of the byte it reads */
+  const uint32_t rawSize = FRAME_HEADER_SIZE + size + FRAME_CRC_SIZE;
+  uint8_t* raw = out + (FRAME_ENCODED_SIZE(size) - rawSize);
+  const uint8_t* bytes = (const uint8_t*)payload;
+
+  raw[0] = (uint8_t)type;
+  raw[1] = (uint8_t)sequence;
+  raw[2] = (uint8_t)(sequence >> 8);
+  for (uint32_t i = 0; size > i; ++i)
+  {
+    raw[FRAME_HEADER_SIZE + i] = bytes[i];
+  }
+
+  const uint16_t crc = crc16(raw, FRAME_HEADER_SIZE + size, CRC16_INIT);
+  raw[FRAME_HEADER_SIZE + size] = (uint8_t)crc;
+  raw[FRAME_HEADER_SIZE + size + 1] = (uint8_t)(crc >> 8);
+
+  const uint32_t length = cobsEncode(raw, rawSize, out);
+  out[length] = FRAME_DELIMITER;
+  return length + 1;
+}
+
+/**
+ * Decode and check a received frame in place.
+ * @param data COBS encoded frame without the delimiter, overwritten
+ * @param size encoded size
+ * @param frame filled on success, payload points into data
+ * @return 1 on success, 0 if malformed or the CRC does not match
+ */
+uint32_t decodeFrame(uint8_t* data, const uint32_t size, Frame* frame)
+{
+  const uint32_t length = cobsDecode(data, size, data);
+
+  if (length < (FRAME_HEADER_SIZE + FRAME_CRC_SIZE))
+  {
+    return 0;
+  }
+
+  const uint32_t payloadSize = length - FRAME_HEADER_SIZE - FRAME_CRC_SIZE;
+  const uint16_t crc = data[length - 2] | (data[length - 1] << 8);
+  if (crc16(data, length - FRAME_CRC_SIZE, CRC16_INIT) != crc)
+  {
+    return 0;
+  }
+
+  frame->type = (FrameType)data[0];
+  frame->sequence = data[1] | (data[2] << 8);
+  frame->payload = data + FRAME_HEADER_SIZE;
+  frame->size = payloadSize;
+  return 1;
+}
@@ -0,0 +1,172 @@
+#include "serial.h"
+#include "config.h"
+#include "device.h"
+#include "probe.h"
+#include "cmsis_os.h"
+
+#define SERIAL_FRAME_SIZE FRAME_ENCODED_SIZE(CONFIG_SERIAL_MAX_PAYLOAD)
+
+/*
+ * Link budget. A character takes 12 bits: start, 8 data, parity and 2 stop
+ * bits. The control loop pushes an 8 byte TelemetrySample per PWM period,
+ * 1 kHz, and usartTask sends them as one frame every
+ * CONFIG_TELEMETRY_PERIOD_MS, 10 samples in 87 bytes at 10 ms:
+ *   115200 baud:  9600 B/s, telemetry 8700 B/s, 91 %
+ *   460800 baud: 38400 B/s, telemetry 8700 B/s, 23 %
+ * Telemetry gets half of the link at most, responses share it.
+ */
+#define UART_CHARACTER_BITS     12
+#define TELEMETRY_RATE_HZ       1000
+#define TELEMETRY_SAMPLE_SIZE   8
+#define TELEMETRY_FRAME_SIZE \
+  FRAME_ENCODED_SIZE((TELEMETRY_RATE_HZ * CONFIG_TELEMETRY_PERIOD_MS / 1000) \
+                     * TELEMETRY_SAMPLE_SIZE)
+
+#if (2 * TELEMETRY_FRAME_SIZE * 1000 / CONFIG_TELEMETRY_PERIOD_MS) \
+    > (CONFIG_UART_BAUD_RATE / UART_CHARACTER_BITS)
+#error "Telemetry needs more than half of CONFIG_UART_BAUD_RATE"
+#endif
+
+/* One frame is on the wire while the next one is encoded, DMA source so
+ * never in CCM */
+static uint8_t frames[2][SERIAL_FRAME_SIZE];
+static uint32_t nextFrame = 0;
+static uint16_t sequence = 0;
+
+static osSemaphoreId txIdle = NULL;
+static osMutexId txLock = NULL;
+
+/* Encoded frame being collected up to its delimiter, decoded in place */
+static uint8_t rxFrame[SERIAL_FRAME_SIZE];
+static uint32_t rxLength = 0;
+static uint8_t rxDiscard = 0;
+static uint8_t rxBytes[64];
+static uint32_t rxBytesCount = 0;
+static uint32_t rxBytesNext = 0;
+
+static osSemaphoreId rxReady = NULL;
+
+static void serialTxComplete(void);
+static void serialRxReady(void);
+
+void setupSerial(void)
+{
+  osSemaphoreDef(serialTxIdle);
+  txIdle = osSemaphoreCreate(osSemaphore(serialTxIdle), 1);
+
+  osMutexDef(serialTxLock);
+  txLock = osMutexCreate(osMutex(serialTxLock));
+
+  osSemaphoreDef(serialRxReady);
+  rxReady = osSemaphoreCreate(osSemaphore(serialRxReady), 1);
+
+  setUartTxHandler(serialTxComplete);
+  setUartRxHandler(serialRxReady);
+}
+
+/**
+ * Frame and queue a payload for USART1 DMA transmission.
+ * Returns as soon as the transfer is started, the caller only sleeps
+ * while both frame buffers are in use.
+ * @param type frame type
+ * @param payload copied into the frame buffer, can be reused on return
+ * @param size up to CONFIG_SERIAL_MAX_PAYLOAD bytes
+ * @return wire length of the frame, 0 if it was not sent
+ */
+uint32_t sendFrame(const FrameType type, const void* payload,
+                   const uint32_t size)
+{
+  if (size > CONFIG_SERIAL_MAX_PAYLOAD)
+  {
+    return 0;
+  }
+
+  osMutexWait(txLock, osWaitForever);
+
+  PROBE_BEGIN(PROBE_FRAME_ENCODE);
+  uint8_t* frame = frames[nextFrame];
+  uint32_t length = encodeFrame(type, sequence, payload, size, frame);
+  PROBE_END(PROBE_FRAME_ENCODE);
+
+  /* Sleep until the frame in the other buffer is on the wire */
+  osSemaphoreWait(txIdle, osWaitForever);
+  if (uartSend(frame, length))
+  {
+    sequence++;
+    nextFrame ^= 1;
+  }
+  else
+  {
+    osSemaphoreRelease(txIdle);
+    length = 0;
+  }
+
+  osMutexRelease(txLock);
+  return length;
+}
+
+/**
+ * Wait for the next valid frame from USART1, only one task may receive.
+ * Frames that are too long or fail the CRC are dropped silently.
+ * @param frame filled on success, payload valid until the next call
+ * @param timeout in ms to wait for received bytes, osWaitForever
+ * @return 1 if a frame was received, 0 on timeout
+ */
+uint32_t receiveFrame(Frame* frame, const uint32_t timeout)
+{
+  while (1)
+  {
+    if (rxBytesNext == rxBytesCount)
+    {
+      rxBytesNext = 0;
+      rxBytesCount = uartReceive(rxBytes, sizeof(rxBytes));
+      if (rxBytesCount == 0)
+      {
+        if (osSemaphoreWait(rxReady, timeout) != osOK)
+        {
+          return 0;
+        }
+        continue;
+      }
+    }
+
+    const uint8_t byte = rxBytes[rxBytesNext++];
+    if (byte != FRAME_DELIMITER)
+    {
+      if (rxLength < sizeof(rxFrame))
+      {
+        rxFrame[rxLength++] = byte;
+      }
+      else
+      {
+        rxDiscard = 1;
+      }
+      continue;
+    }
+
+    const uint32_t length = rxLength;
+    const uint8_t discard = rxDiscard;
+    rxLength = 0;
+    rxDiscard = 0;
+    if (!discard && (length > 0) && decodeFrame(rxFrame, length, frame))
+    {
+      return 1;
+    }
+  }
+}
+
+/**
+ * USART1 received a burst, called from interrupt.
+ */
+static void serialRxReady(void)
+{
+  osSemaphoreRelease(rxReady);
+}
+
+/**
+ * USART1 transmit complete, called from interrupt.
+ */
+static void serialTxComplete(void)
+{
+  osSemaphoreRelease(txIdle);
+}
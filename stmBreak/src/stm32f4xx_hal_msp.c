@@ -1,5 +1,12 @@
 /* Includes ------------------------------------------------------------------*/
 #include "stm32f4xx_hal.h"
+#include "config.h"
+
+extern DMA_HandleTypeDef hdma_adc1;
+extern DMA_HandleTypeDef hdma_usart1_tx;
+extern DMA_HandleTypeDef hdma_usart1_rx;
+
+static void MSP_Error_Handler(void);
 
 /**
   * Initializes the Global MSP.
@@ -39,6 +46,24 @@ void HAL_ADC_MspInit(ADC_HandleTypeDef* hadc)
     GPIO_InitStruct.Mode = GPIO_MODE_ANALOG;
     GPIO_InitStruct.Pull = GPIO_NOPULL;
     HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
+
+    /* ADC1 DMA Init, circular halfword transfers into the sample ring */
+    hdma_adc1.Instance = DMA2_Stream0;
+    hdma_adc1.Init.Channel = DMA_CHANNEL_0;
+    hdma_adc1.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_adc1.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_adc1.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_adc1.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+    hdma_adc1.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    hdma_adc1.Init.Mode = DMA_CIRCULAR;
+    hdma_adc1.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_adc1.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_adc1) != HAL_OK)
+    {
+      MSP_Error_Handler();
+    }
+
+    __HAL_LINKDMA(hadc, DMA_Handle, hdma_adc1);
   }
 }
 
@@ -54,6 +79,8 @@ void HAL_ADC_MspDeInit(ADC_HandleTypeDef* hadc)
     */
     HAL_GPIO_DeInit(GPIOC, GPIO_PIN_1);
 
+    /* ADC1 DMA DeInit */
+    HAL_DMA_DeInit(hadc->DMA_Handle);
   }
 }
 
@@ -74,6 +101,11 @@ void HAL_TIM_Base_MspInit(TIM_HandleTypeDef* htim_base)
     GPIO_InitStruct.Alternate = GPIO_AF1_TIM1;
     HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
   }
+  else if(htim_base->Instance==TIM2)
+  {
+    /* Peripheral clock enable, TIM2 only drives the ADC1 trigger */
+    __HAL_RCC_TIM2_CLK_ENABLE();
+  }
 }
 
 void HAL_TIM_Base_MspDeInit(TIM_HandleTypeDef* htim_base)
@@ -84,6 +116,11 @@ void HAL_TIM_Base_MspDeInit(TIM_HandleTypeDef* htim_base)
     __HAL_RCC_TIM1_CLK_DISABLE();
     HAL_GPIO_DeInit(GPIOA, GPIO_PIN_9);
   }
+  else if(htim_base->Instance==TIM2)
+  {
+    /* Peripheral clock disable */
+    __HAL_RCC_TIM2_CLK_DISABLE();
+  }
 }
 
 void HAL_UART_MspInit(UART_HandleTypeDef* huart)
@@ -111,6 +148,46 @@ void HAL_UART_MspInit(UART_HandleTypeDef* huart)
       GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
       GPIO_InitStruct.Alternate = GPIO_AF7_USART1;
       HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+      /* USART1 DMA Init, TX frames */
+      hdma_usart1_tx.Instance = DMA2_Stream7;
+      hdma_usart1_tx.Init.Channel = DMA_CHANNEL_4;
+      hdma_usart1_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+      hdma_usart1_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+      hdma_usart1_tx.Init.MemInc = DMA_MINC_ENABLE;
+      hdma_usart1_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+      hdma_usart1_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+      hdma_usart1_tx.Init.Mode = DMA_NORMAL;
+      hdma_usart1_tx.Init.Priority = DMA_PRIORITY_LOW;
+      hdma_usart1_tx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+      if (HAL_DMA_Init(&hdma_usart1_tx) != HAL_OK)
+      {
+        MSP_Error_Handler();
+      }
+
+      __HAL_LINKDMA(huart, hdmatx, hdma_usart1_tx);
+
+      /* USART1 DMA Init, RX ring */
+      hdma_usart1_rx.Instance = DMA2_Stream2;
+      hdma_usart1_rx.Init.Channel = DMA_CHANNEL_4;
+      hdma_usart1_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+      hdma_usart1_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+      hdma_usart1_rx.Init.MemInc = DMA_MINC_ENABLE;
+      hdma_usart1_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+      hdma_usart1_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+      hdma_usart1_rx.Init.Mode = DMA_CIRCULAR;
+      hdma_usart1_rx.Init.Priority = DMA_PRIORITY_MEDIUM;
+      hdma_usart1_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+      if (HAL_DMA_Init(&hdma_usart1_rx) != HAL_OK)
+      {
+        MSP_Error_Handler();
+      }
+
+      __HAL_LINKDMA(huart, hdmarx, hdma_usart1_rx);
+
+      /* USART1 interrupt, transmission complete after the DMA, idle line */
+      HAL_NVIC_SetPriority(USART1_IRQn, CONFIG_UART_IRQ_PRIORITY, 0);
+      HAL_NVIC_EnableIRQ(USART1_IRQn);
     }
 }
 
@@ -128,5 +205,18 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef* huart)
       HAL_GPIO_DeInit(GPIOA, GPIO_PIN_10);
       HAL_GPIO_DeInit(GPIOB, GPIO_PIN_6);
 
+      /* USART1 DMA DeInit */
+      HAL_DMA_DeInit(huart->hdmatx);
+      HAL_DMA_DeInit(huart->hdmarx);
+
+      /* USART1 interrupt DeInit */
+      HAL_NVIC_DisableIRQ(USART1_IRQn);
+
     }
 }
+
+static void MSP_Error_Handler(void)
+{
+  while (1)
+  {}
+}
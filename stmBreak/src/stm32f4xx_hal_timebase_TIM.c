@@ -1,11 +1,26 @@
 /* Includes ------------------------------------------------------------------*/
 #include "stm32f4xx_hal.h"
 #include "stm32f4xx_hal_tim.h"
+#include "config.h"
+#if CONFIG_USE_TICKLESS_IDLE
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Of port.c, portmacro.h declares it only while it is the default */
+void vPortSuppressTicksAndSleep(TickType_t xExpectedIdleTime);
+#endif
 
 /* Private variables ---------------------------------------------------------*/
 TIM_HandleTypeDef        htim7;
 uint32_t                 uwIncrementState = 0;
 
+#if CONFIG_USE_TICKLESS_IDLE
+volatile uint32_t        sysTickCount = 0;
+volatile uint32_t        halTickCount = 0;
+static uint32_t          suppressedTicks = 0;
+extern __IO uint32_t      uwTick;
+#endif
+
 /* Private functions ---------------------------------------------------------*/
 
 /**
@@ -88,3 +103,43 @@ void HAL_ResumeTick(void)
   /* Enable TIM7 Update interrupt */
   __HAL_TIM_ENABLE_IT(&htim7, TIM_IT_UPDATE);
 }
+
+#if CONFIG_USE_TICKLESS_IDLE
+/**
+  * @brief  portSUPPRESS_TICKS_AND_SLEEP() of FreeRTOSConfig.h, called by the
+  *         idle task with the scheduler suspended when no task is due for a
+  *         few ticks.
+  * @note   The port stops the RTOS tick and sleeps in WFI until the next task
+  *         is due or an interrupt fires. TIM7 is kept quiet meanwhile and the
+  *         HAL tick is advanced by the RTOS ticks slept: the ticks the port
+  *         stepped, plus the ones the SysTick interrupt pended. HAL_GetTick()
+  *         so stays within a millisecond of the RTOS time, without drift.
+  * @param  expectedIdleTime: ticks until the next task is due.
+  * @retval None
+  */
+void suppressTicksAndSleep(uint32_t expectedIdleTime)
+{
+  const TickType_t tickCount = xTaskGetTickCount();
+  const uint32_t interrupts = sysTickCount;
+
+  HAL_SuspendTick();
+  vPortSuppressTicksAndSleep(expectedIdleTime);
+
+  const uint32_t slept = (xTaskGetTickCount() - tickCount)
+                         + (sysTickCount - interrupts);
+  uwTick += slept;
+  suppressedTicks += slept;
+  __HAL_TIM_CLEAR_IT(&htim7, TIM_IT_UPDATE);
+  HAL_ResumeTick();
+}
+
+/**
+  * @brief  RTOS ticks spent asleep without a tick interrupt, see
+  *         suppressTicksAndSleep().
+  * @retval ticks since start
+  */
+uint32_t getSuppressedTicks(void)
+{
+  return suppressedTicks;
+}
+#endif /* CONFIG_USE_TICKLESS_IDLE */
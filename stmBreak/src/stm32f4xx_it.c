@@ -1,14 +1,21 @@
 /* Includes ------------------------------------------------------------------*/
 #include "stm32f4xx_it.h"
+#include "device.h"
+#include "input.h"
+#include "probe.h"
 #include "cmsis_device.h"
 #include "cmsis_os.h"
 #include "diag/Trace.h"
-#include <math.h>
 
 /* External variables --------------------------------------------------------*/
 
+extern TIM_HandleTypeDef htim1;
+extern TIM_HandleTypeDef htim2;
 extern TIM_HandleTypeDef htim7;
 extern UART_HandleTypeDef huart1;
+extern DMA_HandleTypeDef hdma_adc1;
+extern DMA_HandleTypeDef hdma_usart1_tx;
+extern DMA_HandleTypeDef hdma_usart1_rx;
 
 /* ****************************************************************************/
 /*            Cortex-M4 Processor Interruption and Exception Handlers         */
@@ -135,6 +142,9 @@ void DebugMon_Handler(void)
 void SysTick_Handler(void)
 {
   /* SysTick_IRQn */
+#if CONFIG_USE_TICKLESS_IDLE
+  sysTickCount++;
+#endif
   osSystickHandler();
 }
 
@@ -150,9 +160,99 @@ void SysTick_Handler(void)
  */
 void TIM7_IRQHandler(void)
 {
+#if CONFIG_USE_TICKLESS_IDLE
+  halTickCount++;
+#endif
   HAL_TIM_IRQHandler(&htim7);
 }
 
+/**
+ * @brief This function handles TIM1 update interrupt, the brake control loop.
+ */
+#if CONFIG_CONTROL_IN_RAM
+void CONTROL_FUNC TIM1_UP_TIM10_IRQHandler(void)
+{
+  /* Only the update interrupt is enabled, TIM10 is unused */
+  if (TIM1->SR & TIM_SR_UIF)
+  {
+    TIM1->SR = ~TIM_SR_UIF;
+    controlLoop();
+  }
+}
+#else
+void TIM1_UP_TIM10_IRQHandler(void)
+{
+  HAL_TIM_IRQHandler(&htim1);
+}
+#endif
+
+#if CONFIG_USE_QEMU
+/**
+ * @brief This function handles TIM3 interrupt, the control loop under QEMU.
+ */
+void CONTROL_FUNC TIM3_IRQHandler(void)
+{
+  if (TIM3->SR & TIM_SR_UIF)
+  {
+    TIM3->SR = ~TIM_SR_UIF;
+    controlLoop();
+  }
+}
+#endif
+
+/**
+ * @brief This function handles DMA2 stream0 global interrupt, ADC1 samples.
+ */
+#if CONFIG_CONTROL_IN_RAM
+void CONTROL_FUNC DMA2_Stream0_IRQHandler(void)
+{
+  adcDmaInterrupt();
+}
+#else
+void DMA2_Stream0_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_adc1);
+}
+#endif
+
+/**
+ * @brief This function handles DMA2 stream2 global interrupt, USART1 RX.
+ */
+void DMA2_Stream2_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_usart1_rx);
+}
+
+/**
+ * @brief This function handles DMA2 stream7 global interrupt, USART1 TX.
+ */
+void DMA2_Stream7_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_usart1_tx);
+}
+
+/**
+ * @brief This function handles USART1 global interrupt.
+ */
+void USART1_IRQHandler(void)
+{
+  if (__HAL_UART_GET_FLAG(&huart1, UART_FLAG_IDLE)
+      && __HAL_UART_GET_IT_SOURCE(&huart1, UART_IT_IDLE))
+  {
+    __HAL_UART_CLEAR_IDLEFLAG(&huart1);
+    uartRxIdle();
+  }
+  HAL_UART_IRQHandler(&huart1);
+}
+
+/**
+ * @brief This function handles Flash global interrupt, erase and program steps.
+ */
+void FLASH_IRQHandler(void)
+{
+  flashEndOfOperation();
+}
+
 /**
  * @brief  Period elapsed callback in non blocking mode
  * @note   This function is called  when TIM2 interrupt took place, inside
@@ -163,67 +263,59 @@ void TIM7_IRQHandler(void)
  */
 void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 {
-  if (htim->Instance == TIM7)
+  if (htim->Instance == TIM1)
+  {
+    controlLoop();
+  }
+  else if (htim->Instance == TIM7)
   {
     HAL_IncTick();
   }
+#if CONFIG_USE_SCRIPTED_ADC
+  else if (htim->Instance == TIM2)
+  {
+    scriptedAdcSample();
+  }
+#endif
 }
 
-void EXTI2_IRQHandler(void)
+#if CONFIG_USE_SCRIPTED_ADC
+/**
+ * @brief This function handles TIM2 global interrupt, scripted ADC samples.
+ */
+void TIM2_IRQHandler(void)
 {
-  HAL_Delay(10);
-  while (HAL_GPIO_ReadPin(GPIOA, GPIO_PIN_2));
-  //osSemaphoreRelease(semaphoreId);
-  //portEND_SWITCHING_ISR(&taskHasWoken)
-  HAL_StatusTypeDef rx_code = 0;
-  HAL_StatusTypeDef tx_code = 0;
-//    while (1)
-  {
-    unsigned char* sendByte = "MOTHERFUCKER\0";
-    tx_code = HAL_UART_Transmit(&huart1, sendByte, 13, 10000);
-    unsigned char byte = 0;
-    rx_code = HAL_UART_Receive(&huart1, &byte, 1, 0);
-    unsigned char dasByte = byte;
-    trace_printf("RX: %s\n", dasByte);
-//        trace_printf("%i %i", tx_code, rx_code);
-    asm("nop");
-  }
-  HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_2);
+  HAL_TIM_IRQHandler(&htim2);
 }
+#endif
 
-extern uint32_t brakeMaxValue;
-extern uint32_t brakeMinValue;
-extern BrakeFunction brakeFunction;
+/* Buttons only stamp the edge, the input task debounces them and acts.
+ * All EXTI lines share one priority, so one probe covers them */
+static void inputInterrupt(const uint16_t pin)
+{
+  PROBE_BEGIN(PROBE_INPUT_EDGE);
+  HAL_GPIO_EXTI_IRQHandler(pin);
+  PROBE_END(PROBE_INPUT_EDGE);
+}
 
-void EXTI3_IRQHandler(void)
+void EXTI0_IRQHandler(void)
 {
-  HAL_Delay(50);
-  while (HAL_GPIO_ReadPin(GPIOC, GPIO_PIN_3));
-  HAL_Delay(50);
+  inputInterrupt(GPIO_PIN_0);
+}
 
-  if (brakeFunction % BF_NR_ITEMS == 0)
-  {
-    brakeFunction = BF_NR_ITEMS;
-  }
-  brakeFunction--;
+void EXTI2_IRQHandler(void)
+{
+  inputInterrupt(GPIO_PIN_2);
+}
 
-  HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_3);
+void EXTI3_IRQHandler(void)
+{
+  inputInterrupt(GPIO_PIN_3);
 }
 
 void EXTI4_IRQHandler(void)
 {
-  HAL_Delay(50);
-  while (HAL_GPIO_ReadPin(GPIOA, GPIO_PIN_4));
-  HAL_Delay(50);
-
-  brakeFunction++;
-  if (brakeFunction % BF_NR_ITEMS == 0)
-  {
-    brakeFunction = 0;
-  }
-
-
-  HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_4);
+  inputInterrupt(GPIO_PIN_4);
 }
 
 void EXTI9_5_IRQHandler(void)
@@ -234,6 +326,6 @@ void EXTI9_5_IRQHandler(void)
 
 void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 {
-  trace_printf("Interrupt from EXTI%i\n", (int) log2(GPIO_Pin));
+  inputEdge(GPIO_Pin);
 }
 
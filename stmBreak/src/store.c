@@ -0,0 +1,781 @@
+#include "store.h"
+#include "device.h"
+#include "protocol.h"
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Append only record log over the user flash sectors 5-11, the DATA region
+ * of mem.ld. Every sector starts with a StoreSector header and a
+ * StoreDirectory, followed by records:
+ *   StoreRecord | data, padded to 4 bytes
+ * Records of all ids share the sectors, packed back to back whatever their
+ * size. A save appends a new version of its record without erasing, the RAM
+ * index points at the newest valid version of every id. Old versions are
+ * reclaimed by compaction: the live records of the oldest sector are copied
+ * to a freshly opened sector, then the old sector is erased. One sector is
+ * always kept erased as the spare.
+ *
+ * The directory is a snapshot of the index, written when a sector is
+ * opened, by compaction only once the survivors are copied, so it never
+ * points at a live record in an erased sector. The mount loads it from the
+ * active sector and replays only the records appended behind it, instead
+ * of reading every sector, then checks the CRC of every current record.
+ * A damaged record falls back to a scan for its last good version, at the
+ * mount or when it is read.
+ */
+
+#define STORE_FIRST_SECTOR 5
+#define STORE_SECTORS      7          // sectors 5..11
+#define STORE_MAGIC        0x334F5453 // "STO3"
+#define STORE_BLANK        0xFFFFFFFF
+#define STORE_NONE         0xFFFFFFFF
+
+typedef struct StoreSector
+{
+  uint32_t magic;
+  uint32_t sequence; // order of activation, the highest one is active
+} StoreSector;
+
+typedef struct StoreRecord
+{
+  uint16_t id;
+  uint16_t size;     // data bytes
+  uint8_t itemSize;  // bytes per item of the data
+  uint8_t reserved[3];
+  uint32_t version;  // per id, the highest valid one is current
+  uint32_t crc;      // CRC-32 over all fields before and the data
+} StoreRecord;
+
+/* Entry n of a directory describes the current record of id n */
+typedef struct StoreDirectoryEntry
+{
+  uint16_t id;
+  uint16_t size;     // data bytes
+  uint8_t itemSize;
+  uint8_t reserved[3];
+  uint32_t offset;   // of the StoreRecord from the first store sector
+  uint32_t version;
+  uint32_t crc;      // StoreRecord.crc
+} StoreDirectoryEntry;
+
+typedef struct StoreDirectory
+{
+  StoreDirectoryEntry entries[STORE_MAX_IDS]; // blank if the id has no record
+  uint32_t crc;      // CRC-32 over the entries
+} StoreDirectory;
+
+/* First record of a sector */
+#define STORE_LOG_OFFSET (sizeof(StoreSector) + sizeof(StoreDirectory))
+
+typedef struct StoreEntry
+{
+  uint32_t address;  // of the current StoreRecord, 0 if there is none
+  uint32_t version;
+} StoreEntry;
+
+typedef struct SectorState
+{
+  uint32_t sequence; // 0 if erased
+  uint32_t used;     // bytes up to the next append
+} SectorState;
+
+static StoreEntry entries[STORE_MAX_IDS];
+static SectorState sectors[STORE_SECTORS];
+static uint32_t activeSector = STORE_NONE;
+static uint32_t nextSequence = 1;
+
+/* Header of the record writeStore() appends. Not on the caller's stack,
+ * which is in CCM with CONFIG_USE_CCM and out of reach of the CRC DMA */
+static StoreRecord newRecord;
+
+static void scanStore(void);
+static void scanSector(const uint32_t sector);
+static uint8_t loadDirectory(const uint32_t sector);
+static uint8_t isIndexComplete(void);
+static uint8_t verifyIndex(void);
+static uint8_t writeDirectory(const uint32_t sector);
+static uint8_t openSector(const uint32_t sector);
+static uint8_t eraseSector(const uint32_t sector);
+static uint8_t reserveSpace(const uint32_t length);
+static uint8_t programRecord(const uint32_t address, const StoreRecord* record,
+                             const void* data);
+static uint32_t findErasedSector(void);
+static uint32_t countErasedSectors(void);
+static uint32_t findOldestSector(void);
+static uint32_t getLiveBytes(const uint32_t sector);
+static uint8_t isBlank(const uint32_t address, const uint32_t size);
+
+static uint32_t sectorAddress(const uint32_t sector)
+{
+  return getFlashSectorAddress(STORE_FIRST_SECTOR + sector);
+}
+
+static uint32_t sectorSize(const uint32_t sector)
+{
+  return getFlashSectorSize(STORE_FIRST_SECTOR + sector);
+}
+
+static uint8_t isInSector(const uint32_t address, const uint32_t sector)
+{
+  return (address >= sectorAddress(sector))
+         && (address < (sectorAddress(sector) + sectorSize(sector)));
+}
+
+static uint8_t isInStore(const uint32_t address)
+{
+  for (uint32_t sector = 0; STORE_SECTORS > sector; ++sector)
+  {
+    if (isInSector(address, sector))
+    {
+      return sectors[sector].sequence != 0;
+    }
+  }
+  return 0;
+}
+
+static uint32_t recordSize(const uint32_t size)
+{
+  return sizeof(StoreRecord) + ((size + 3) & ~3u);
+}
+
+/* On the CRC unit, see computeCrc(), the header first then the data */
+static uint32_t recordCrc(const StoreRecord* record, const void* data)
+{
+  const uint32_t crc = computeCrc(record, offsetof(StoreRecord, crc), CRC32_INIT);
+  return computeCrc(data, record->size, crc);
+}
+
+/**
+ * Rebuild the RAM index from flash, once at boot before any other call.
+ * Reads the directory and the records behind it of the active sector, then
+ * checks the CRC of every current record on the CRC unit. All sectors are
+ * scanned only if that directory or a record is damaged, the scan indexes
+ * the last good version of every id. Sectors that do not hold a store are
+ * erased.
+ * @return 0 if all sectors had to be scanned
+ */
+uint8_t mountStore(void)
+{
+  memset(entries, 0, sizeof(entries));
+  activeSector = STORE_NONE;
+  nextSequence = 1;
+
+  for (uint32_t sector = 0; STORE_SECTORS > sector; ++sector)
+  {
+    const StoreSector* header = (const StoreSector*)sectorAddress(sector);
+
+    sectors[sector].sequence = 0;
+    sectors[sector].used = 0;
+    if (header->magic == STORE_MAGIC)
+    {
+      sectors[sector].sequence = header->sequence;
+      if (header->sequence >= nextSequence)
+      {
+        nextSequence = header->sequence + 1;
+        activeSector = sector;
+      }
+    }
+    else if (header->magic != STORE_BLANK)
+    {
+      eraseSector(sector);
+    }
+  }
+
+  if (activeSector == STORE_NONE)
+  {
+    return 1;
+  }
+  const uint8_t directory = loadDirectory(activeSector);
+  if (directory)
+  {
+    scanSector(activeSector);
+    if (isIndexComplete() && verifyIndex())
+    {
+      return 1;
+    }
+  }
+
+  /* Cut short while the directory was written, or while a compaction
+   * copied the survivors ahead of it, or a record went bad, go through all
+   * records */
+  scanStore();
+  if (directory)
+  {
+    return 0;
+  }
+
+  /* Write the directory if it is blank, or close the sector if it is
+   * damaged, so the next write opens one with a good directory */
+  if (isBlank(sectorAddress(activeSector) + sizeof(StoreSector),
+              sizeof(StoreDirectory)))
+  {
+    writeDirectory(activeSector);
+  }
+  else
+  {
+    sectors[activeSector].used = sectorSize(activeSector);
+  }
+  return 0;
+}
+
+/**
+ * @param id record id
+ * @return data size of the current version, 0 if there is none
+ */
+uint32_t getStoreSize(const uint32_t id)
+{
+  if ((id >= STORE_MAX_IDS) || (entries[id].address == 0))
+  {
+    return 0;
+  }
+  return ((const StoreRecord*)entries[id].address)->size;
+}
+
+/**
+ * @param id record id
+ * @return item size of the current version, 0 if there is none
+ */
+uint32_t getStoreItemSize(const uint32_t id)
+{
+  if ((id >= STORE_MAX_IDS) || (entries[id].address == 0))
+  {
+    return 0;
+  }
+  return ((const StoreRecord*)entries[id].address)->itemSize;
+}
+
+/**
+ * Map the current version of a record in place, without a copy.
+ * The header and CRC are checked again, flash may have changed since the
+ * mount. A damaged record rebuilds the index by a scan of all sectors,
+ * which finds the last good version. Valid until the next writeStore() or
+ * compactStore(), which can move the record.
+ * @param id record id
+ * @param size set to the data size, may be NULL
+ * @return data in flash, NULL if the record does not exist or no version
+ *         of it is intact
+ */
+const void* mapStore(const uint32_t id, uint32_t* size)
+{
+  if ((id >= STORE_MAX_IDS) || (entries[id].address == 0))
+  {
+    return NULL;
+  }
+
+  const StoreRecord* record = (const StoreRecord*)entries[id].address;
+  if ((record->id != id) || (recordCrc(record, record + 1) != record->crc))
+  {
+    scanStore();
+    record = (const StoreRecord*)entries[id].address;
+    if (record == NULL)
+    {
+      return NULL;
+    }
+  }
+
+  if (size)
+  {
+    *size = record->size;
+  }
+  return record + 1;
+}
+
+/**
+ * Copy the current version of a record.
+ * @param id record id
+ * @param data destination
+ * @param size capacity of data in bytes
+ * @return number of bytes copied, 0 if the record does not exist or is
+ *         damaged
+ */
+uint32_t readStore(const uint32_t id, void* data, const uint32_t size)
+{
+  uint32_t length = 0;
+  const void* record = mapStore(id, &length);
+
+  if (record == NULL)
+  {
+    return 0;
+  }
+  if (length > size)
+  {
+    length = size;
+  }
+  memcpy(data, record, length);
+  return length;
+}
+
+/**
+ * Append a new version of a record. Erases only when every sector but the
+ * spare is used, storeNeedsCompaction() tells when to compact ahead.
+ * @param id record id
+ * @param data record data
+ * @param size in bytes
+ * @param itemSize bytes per item, kept along for readers
+ * @return 1 on success, 0 if the store is full or on a flash error
+ */
+uint8_t writeStore(const uint32_t id, const void* data, const uint32_t size,
+                   const uint32_t itemSize)
+{
+  const uint32_t length = recordSize(size);
+  StoreRecord* record = &newRecord;
+
+  if ((id >= STORE_MAX_IDS) || (size > 0xFFFF) || (itemSize > 0xFF)
+      || (length > (sectorSize(0) - STORE_LOG_OFFSET))
+      || !reserveSpace(length))
+  {
+    return 0;
+  }
+
+  memset(record, 0, sizeof(*record));
+  record->id = id;
+  record->size = size;
+  record->itemSize = itemSize;
+  record->version = entries[id].version + 1;
+  record->crc = recordCrc(record, data);
+
+  /* The space is spent even if programming fails */
+  const uint32_t address = sectorAddress(activeSector) + sectors[activeSector].used;
+  sectors[activeSector].used += length;
+
+  if (!programRecord(address, record, data))
+  {
+    return 0;
+  }
+
+  entries[id].address = address;
+  entries[id].version = record->version;
+  return 1;
+}
+
+/**
+ * @return 1 if only the spare sector is left erased
+ */
+uint8_t storeNeedsCompaction(void)
+{
+  return (countErasedSectors() <= 1) && (findOldestSector() != STORE_NONE);
+}
+
+/**
+ * Reclaim the oldest sector, blocks for its erase.
+ * @return 1 if a sector was erased
+ */
+uint8_t compactStore(void)
+{
+  uint32_t sector;
+
+  return beginCompaction(&sector) && endCompaction(sector);
+}
+
+/**
+ * First step of compactStore(). The live records of the oldest sector are
+ * copied to the spare sector, whose directory is written once they are all
+ * there, the mount after a cut in between scans all sectors. Nothing in
+ * the index points into the old sector afterwards, so reads may go on
+ * while endCompaction() erases it, writes may not.
+ * @param sector set to the sector endCompaction() erases
+ * @return 1 if the sector is ready to be erased
+ */
+uint8_t beginCompaction(uint32_t* sector)
+{
+  const uint32_t victim = findOldestSector();
+
+  if (victim == STORE_NONE)
+  {
+    return 0;
+  }
+
+  /* Nothing to copy from a sector of only old versions, or from the
+   * victim of a compaction cut short before its erase */
+  if (getLiveBytes(victim) > 0)
+  {
+    const uint32_t spare = findErasedSector();
+    if ((spare == STORE_NONE) || !openSector(spare))
+    {
+      return 0;
+    }
+
+    for (uint32_t id = 0; STORE_MAX_IDS > id; ++id)
+    {
+      if (entries[id].address && isInSector(entries[id].address, victim))
+      {
+        const StoreRecord* record = (const StoreRecord*)entries[id].address;
+        const uint32_t address = sectorAddress(spare) + sectors[spare].used;
+
+        sectors[spare].used += recordSize(record->size);
+        if (!programRecord(address, record, record + 1))
+        {
+          return 0;
+        }
+        entries[id].address = address;
+      }
+    }
+
+    if (!writeDirectory(spare))
+    {
+      return 0;
+    }
+  }
+
+  sectors[victim].sequence = 0;
+  sectors[victim].used = 0;
+  *sector = victim;
+  return 1;
+}
+
+/**
+ * Second step of compactStore(), blocks for the erase.
+ * @param sector from beginCompaction()
+ * @return 1 if the sector was erased
+ */
+uint8_t endCompaction(const uint32_t sector)
+{
+  return (sector < STORE_SECTORS) && eraseFlash(STORE_FIRST_SECTOR + sector, 1);
+}
+
+/**
+ * Index the last good version of every id from all sectors.
+ */
+static void scanStore(void)
+{
+  memset(entries, 0, sizeof(entries));
+  for (uint32_t sector = 0; STORE_SECTORS > sector; ++sector)
+  {
+    if (sectors[sector].sequence != 0)
+    {
+      scanSector(sector);
+    }
+  }
+}
+
+/**
+ * Index the records of a sector, newer versions replace what the index
+ * holds. Sets the append position of the sector.
+ */
+static void scanSector(const uint32_t sector)
+{
+  const uint32_t base = sectorAddress(sector);
+  const uint32_t size = sectorSize(sector);
+  uint32_t offset = STORE_LOG_OFFSET;
+
+  while ((offset + sizeof(StoreRecord)) <= size)
+  {
+    const StoreRecord* record = (const StoreRecord*)(base + offset);
+    const uint32_t length = recordSize(record->size);
+
+    if ((record->id == 0xFFFF) && (record->size == 0xFFFF))
+    {
+      break; // end of the log
+    }
+    if ((offset + length) > size)
+    {
+      offset = size; // torn header, the sector is closed
+      break;
+    }
+
+    /* Records failing the CRC were cut short, skip them */
+    if ((record->id < STORE_MAX_IDS)
+        && (recordCrc(record, record + 1) == record->crc))
+    {
+      StoreEntry* entry = &entries[record->id];
+      if ((entry->address == 0) || (record->version >= entry->version))
+      {
+        entry->address = (uint32_t)record;
+        entry->version = record->version;
+      }
+    }
+    offset += length;
+  }
+  sectors[sector].used = offset;
+
+  /* An append cut short leaves programmed words behind the last record,
+   * do not program over them */
+  if ((sector == activeSector)
+      && !isBlank(base + offset, size - offset))
+  {
+    sectors[sector].used = size;
+  }
+}
+
+/**
+ * Fill the index from the directory of a sector. Only the record headers
+ * are checked against it, verifyIndex() checks the data. An entry pointing
+ * into an erased sector was replaced by a record behind the directory
+ * before compaction erased it, the replay of the sector indexes that one.
+ * @return 0 if the directory or a record it points to is damaged
+ */
+static uint8_t loadDirectory(const uint32_t sector)
+{
+  const StoreDirectory* directory =
+      (const StoreDirectory*)(sectorAddress(sector) + sizeof(StoreSector));
+
+  if (computeCrc(directory->entries, sizeof(directory->entries), CRC32_INIT)
+      != directory->crc)
+  {
+    return 0;
+  }
+
+  for (uint32_t id = 0; STORE_MAX_IDS > id; ++id)
+  {
+    const StoreDirectoryEntry* entry = &directory->entries[id];
+    if (entry->offset == STORE_BLANK)
+    {
+      continue;
+    }
+
+    const uint32_t address = sectorAddress(0) + entry->offset;
+    const StoreRecord* record = (const StoreRecord*)address;
+    if (entry->id != id)
+    {
+      return 0;
+    }
+    entries[id].version = entry->version;
+    if (!isInStore(address))
+    {
+      continue;
+    }
+    if ((record->id != id) || (record->version != entry->version)
+        || (record->crc != entry->crc))
+    {
+      return 0;
+    }
+    entries[id].address = address;
+  }
+  return 1;
+}
+
+/**
+ * @return 0 if an id the directory knows has no record after the replay
+ */
+static uint8_t isIndexComplete(void)
+{
+  for (uint32_t id = 0; STORE_MAX_IDS > id; ++id)
+  {
+    if ((entries[id].address == 0) && (entries[id].version != 0))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Check the data of every indexed record against its CRC.
+ * @return 0 if a record is damaged
+ */
+static uint8_t verifyIndex(void)
+{
+  for (uint32_t id = 0; STORE_MAX_IDS > id; ++id)
+  {
+    const StoreRecord* record = (const StoreRecord*)entries[id].address;
+    if ((record != NULL) && (recordCrc(record, record + 1) != record->crc))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Program the index as the directory of a freshly opened sector, entry by
+ * entry, ids without a record stay blank.
+ */
+static uint8_t writeDirectory(const uint32_t sector)
+{
+  const uint32_t address = sectorAddress(sector) + sizeof(StoreSector);
+  StoreDirectoryEntry entry;
+  uint32_t crc = CRC32_INIT;
+
+  for (uint32_t id = 0; STORE_MAX_IDS > id; ++id)
+  {
+    memset(&entry, 0xFF, sizeof(entry));
+    if (entries[id].address)
+    {
+      const StoreRecord* record = (const StoreRecord*)entries[id].address;
+
+      memset(entry.reserved, 0, sizeof(entry.reserved));
+      entry.id = id;
+      entry.size = record->size;
+      entry.itemSize = record->itemSize;
+      entry.offset = entries[id].address - sectorAddress(0);
+      entry.version = record->version;
+      entry.crc = record->crc;
+      if (!programFlash(address + (id * sizeof(entry)), &entry,
+                        sizeof(entry) / 4, 4))
+      {
+        return 0;
+      }
+    }
+    crc = computeCrc(&entry, sizeof(entry), crc);
+  }
+
+  return programFlash(address + offsetof(StoreDirectory, crc), &crc, 1, 4);
+}
+
+static uint8_t openSector(const uint32_t sector)
+{
+  StoreSector header;
+
+  if (!isBlank(sectorAddress(sector), sectorSize(sector))
+      && !eraseSector(sector))
+  {
+    return 0;
+  }
+
+  header.magic = STORE_MAGIC;
+  header.sequence = nextSequence++;
+  if (!programFlash(sectorAddress(sector), &header, sizeof(header) / 4, 4))
+  {
+    return 0;
+  }
+
+  sectors[sector].sequence = header.sequence;
+  sectors[sector].used = STORE_LOG_OFFSET;
+  activeSector = sector;
+  return 1;
+}
+
+static uint8_t eraseSector(const uint32_t sector)
+{
+  sectors[sector].sequence = 0;
+  sectors[sector].used = 0;
+  if (activeSector == sector)
+  {
+    activeSector = STORE_NONE;
+  }
+  return eraseFlash(STORE_FIRST_SECTOR + sector, 1);
+}
+
+static uint8_t reserveSpace(const uint32_t length)
+{
+  for (uint32_t i = 0; STORE_SECTORS > i; ++i)
+  {
+    if ((activeSector != STORE_NONE)
+        && ((sectors[activeSector].used + length) <= sectorSize(activeSector)))
+    {
+      return 1;
+    }
+
+    /* Move on to an erased sector, but keep the spare */
+    if (countErasedSectors() > 1)
+    {
+      const uint32_t sector = findErasedSector();
+      if (!openSector(sector) || !writeDirectory(sector))
+      {
+        return 0;
+      }
+    }
+    else if (!compactStore())
+    {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+static uint8_t programRecord(const uint32_t address, const StoreRecord* record,
+                             const void* data)
+{
+  const uint32_t words = record->size / 4;
+  const uint32_t rest = record->size % 4;
+  uint32_t last = STORE_BLANK;
+
+  /* Header first, a record cut short then fails its CRC and is skipped */
+  if (!programFlash(address, record, sizeof(StoreRecord) / 4, 4))
+  {
+    return 0;
+  }
+  if ((words > 0)
+      && !programFlash(address + sizeof(StoreRecord), data, words, 4))
+  {
+    return 0;
+  }
+  if (rest > 0)
+  {
+    memcpy(&last, (const uint8_t*)data + (words * 4), rest);
+    return programFlash(address + sizeof(StoreRecord) + (words * 4), &last, 1, 4);
+  }
+  return 1;
+}
+
+/**
+ * @return first erased sector after the active one, going round the
+ * sectors in order spreads the erases evenly
+ */
+static uint32_t findErasedSector(void)
+{
+  const uint32_t first = (activeSector == STORE_NONE) ? 0 : activeSector + 1;
+
+  for (uint32_t i = 0; STORE_SECTORS > i; ++i)
+  {
+    const uint32_t sector = (first + i) % STORE_SECTORS;
+    if (sectors[sector].sequence == 0)
+    {
+      return sector;
+    }
+  }
+  return STORE_NONE;
+}
+
+static uint32_t countErasedSectors(void)
+{
+  uint32_t count = 0;
+
+  for (uint32_t sector = 0; STORE_SECTORS > sector; ++sector)
+  {
+    if (sectors[sector].sequence == 0)
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+/**
+ * @return oldest sector in use other than the active one, STORE_NONE if
+ * there is none
+ */
+static uint32_t findOldestSector(void)
+{
+  uint32_t oldest = STORE_NONE;
+
+  for (uint32_t sector = 0; STORE_SECTORS > sector; ++sector)
+  {
+    if ((sectors[sector].sequence != 0) && (sector != activeSector)
+        && ((oldest == STORE_NONE)
+            || (sectors[sector].sequence < sectors[oldest].sequence)))
+    {
+      oldest = sector;
+    }
+  }
+  return oldest;
+}
+
+static uint32_t getLiveBytes(const uint32_t sector)
+{
+  uint32_t bytes = 0;
+
+  for (uint32_t id = 0; STORE_MAX_IDS > id; ++id)
+  {
+    if (entries[id].address && isInSector(entries[id].address, sector))
+    {
+      bytes += recordSize(((const StoreRecord*)entries[id].address)->size);
+    }
+  }
+  return bytes;
+}
+
+static uint8_t isBlank(const uint32_t address, const uint32_t size)
+{
+  const uint32_t* word = (const uint32_t*)address;
+
+  for (uint32_t i = 0; (size / 4) > i; ++i)
+  {
+    if (word[i] != STORE_BLANK)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
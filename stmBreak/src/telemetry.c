@@ -0,0 +1,77 @@
+#include "telemetry.h"
+#include <string.h>
+
+#define TELEMETRY_MASK (CONFIG_TELEMETRY_RING_SIZE - 1)
+
+/* Orders the sample copy against the index update, a DMB on Cortex-M */
+#define telemetryBarrier() __sync_synchronize()
+
+void initTelemetry(TelemetryRing* ring)
+{
+  ring->head = 0;
+  ring->tail = 0;
+  ring->overruns = 0;
+}
+
+/**
+ * Producer side, callable from an interrupt. Never blocks, a full ring
+ * drops the sample and counts an overrun.
+ * @param ring telemetry ring
+ * @param sample record to append
+ * @return 1 if stored, 0 on overrun
+ */
+uint32_t CONTROL_FUNC pushTelemetry(TelemetryRing* ring, const TelemetrySample* sample)
+{
+  const uint32_t head = ring->head;
+
+  if ((head - ring->tail) >= CONFIG_TELEMETRY_RING_SIZE)
+  {
+    ring->overruns++;
+    return 0;
+  }
+
+  ring->samples[head & TELEMETRY_MASK] = *sample;
+  telemetryBarrier();
+  ring->head = head + 1;
+  return 1;
+}
+
+/**
+ * Consumer side, copy out up to count samples in one go.
+ * @param ring telemetry ring
+ * @param samples destination
+ * @param count capacity of samples
+ * @return number of samples copied
+ */
+uint32_t readTelemetry(TelemetryRing* ring, TelemetrySample* samples,
+                       const uint32_t count)
+{
+  const uint32_t tail = ring->tail;
+  uint32_t available = ring->head - tail;
+
+  if (available > count)
+  {
+    available = count;
+  }
+  telemetryBarrier();
+
+  /* At most two contiguous runs, before and after the wrap */
+  const uint32_t first = tail & TELEMETRY_MASK;
+  uint32_t run = CONFIG_TELEMETRY_RING_SIZE - first;
+  if (run > available)
+  {
+    run = available;
+  }
+  memcpy(samples, &ring->samples[first], run * sizeof(TelemetrySample));
+  memcpy(samples + run, &ring->samples[0],
+         (available - run) * sizeof(TelemetrySample));
+
+  telemetryBarrier();
+  ring->tail = tail + available;
+  return available;
+}
+
+uint32_t getTelemetryLevel(const TelemetryRing* ring)
+{
+  return ring->head - ring->tail;
+}